@@ -1,67 +1,163 @@
 #include "AsyncMgr.h"
-#include <windows.h>
 
 
+CancelToken::CancelToken() :
+  State(std::make_shared<CancelState>())
+{
+  State->Cancelled = false;
+}
+
+CancelToken CancelToken::Child() const
+{
+  CancelToken child;
+  child.State->Parent = State;
+  return child;
+}
+
+void CancelToken::Cancel()
+{
+  State->Cancelled = true;
+}
+
+bool CancelToken::IsCancelled() const
+{
+  for (const CancelState* state = State.get(); nullptr != state; state = state->Parent.get())
+  {
+    if (true == state->Cancelled)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 AsyncMgr* AsyncMgr::Instance()
 {
-  static AsyncMgr instance;
+  static AsyncMgr instance(DEFAULT_WORKER_COUNT);
   return &instance;
 }
 
-uintptr_t AsyncMgr::Spawn(void* func, void* param)
+CancelToken AsyncMgr::GetToken() const
+{
+  return Token;
+}
+
+// Starts workers until there are at least workerCount, for callers that
+// need that many tasks running at once
+void AsyncMgr::Reserve(size_t workerCount)
 {
-  uintptr_t taskId = 0;
-
-  AsyncEntry entry;
-  entry.kill_flag = false;
-  entry.handle = CreateThread(0, 
-                              0, 
-                              reinterpret_cast<LPTHREAD_START_ROUTINE>(func), 
-                              param, 0, 
-                              reinterpret_cast<DWORD*>(&taskId));
-  if (INVALID_HANDLE_VALUE == entry.handle)
+  std::lock_guard<std::mutex> lock(QueueLock);
+  if (true == Stopping)
   {
-    return 0;
+    return;
   }
 
-  AsyncMap[taskId] = entry;
-
-  return taskId;
+  while (Workers.size() < workerCount)
+  {
+    ++RunningWorkers;
+    Workers.push_back(std::thread(&AsyncMgr::WorkerLoop, this));
+  }
 }
 
-bool AsyncMgr::Kill(uintptr_t taskId, bool force)
+bool AsyncMgr::Shutdown(std::chrono::milliseconds timeout)
 {
-  bool res = false;
-  if (AsyncMap.end() != AsyncMap.find(taskId))
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+
+  // Cancel running tasks and drop queued ones, their futures report a
+  // broken promise.
+  std::deque<std::function<void()>> dropped;
   {
-    AsyncMap[taskId].kill_flag = true;
-    res = true;
+    std::lock_guard<std::mutex> lock(QueueLock);
+    if (true == Stopping)
+    {
+      return Workers.empty();
+    }
 
-    if (true == force)
+    Stopping = true;
+    Token.Cancel();
+    dropped.swap(Queue);
+  }
+
+  QueueEvent.notify_all();
+  dropped.clear();
+
+  bool clean = false;
+  {
+    std::unique_lock<std::mutex> lock(QueueLock);
+    clean = ExitEvent.wait_until(lock, deadline, [this]() { return 0 == RunningWorkers; });
+  }
+
+  // Workers that didn't observe the cancellation in time are abandoned
+  // rather than blocking exit.
+  for (size_t i = 0; i < Workers.size(); ++i)
+  {
+    if (true == clean)
+    {
+      Workers[i].join();
+    }
+    else
     {
-      TerminateThread(AsyncMap[taskId].handle, 0);
+      Workers[i].detach();
     }
   }
 
-  return res;
+  Workers.clear();
+
+  return clean;
 }
 
-bool AsyncMgr::KeepAlive(uintptr_t taskId)
+bool AsyncMgr::Enqueue(std::function<void()> task)
 {
-  if (AsyncMap.end() != AsyncMap.find(taskId))
   {
-    return !AsyncMap[taskId].kill_flag;
+    std::lock_guard<std::mutex> lock(QueueLock);
+    if (true == Stopping)
+    {
+      return false;
+    }
+
+    Queue.push_back(task);
   }
 
-  return false;
+  QueueEvent.notify_one();
+
+  return true;
 }
 
-AsyncMgr::AsyncMgr()
+void AsyncMgr::WorkerLoop()
 {
+  std::unique_lock<std::mutex> lock(QueueLock);
+  for (;;)
+  {
+    QueueEvent.wait(lock, [this]() { return (true == Stopping) || (false == Queue.empty()); });
+    if (true == Stopping)
+    {
+      break;
+    }
+
+    std::function<void()> task = Queue.front();
+    Queue.pop_front();
 
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+
+  --RunningWorkers;
+  ExitEvent.notify_all();
 }
 
-AsyncMgr::~AsyncMgr()
+AsyncMgr::AsyncMgr(size_t workerCount) :
+  RunningWorkers(workerCount),
+  Stopping(false)
 {
+  for (size_t i = 0; i < workerCount; ++i)
+  {
+    Workers.push_back(std::thread(&AsyncMgr::WorkerLoop, this));
+  }
+}
 
-}
\ No newline at end of file
+AsyncMgr::~AsyncMgr()
+{
+  Shutdown(std::chrono::milliseconds(2000));
+}
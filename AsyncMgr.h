@@ -1,26 +1,100 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <future>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+// Cooperative cancellation flag. Tasks check it at their own safe points
+// (between BLE operations) and return early once it is set. Cancelling a
+// token also cancels every token derived from it with Child().
+class CancelToken
+{
+public:
+
+  CancelToken();
+  CancelToken Child() const;
+  void Cancel();
+  bool IsCancelled() const;
+
+private:
+
+  struct CancelState
+  {
+    std::atomic<bool> Cancelled;
+    std::shared_ptr<CancelState> Parent;
+  };
+
+  std::shared_ptr<CancelState> State;
+};
+
+// Worker pool, grown with Reserve() but never shrunk. Tasks receive a
+// CancelToken and hand their result back through a std::future.
 class AsyncMgr
 {
 public:
 
+  // The scan loop plus the connection fan-out of a few adapters
+  static const size_t DEFAULT_WORKER_COUNT = 16;
+
   static AsyncMgr* Instance();
-  uintptr_t Spawn(void* func, void* param);
-  bool Kill(uintptr_t taskId, bool force = false);
-  bool KeepAlive(uintptr_t taskId);
+
+  template <typename Func>
+  auto Spawn(Func func) -> std::future<decltype(func(CancelToken()))>;
+  template <typename Func>
+  auto Spawn(Func func, CancelToken token) -> std::future<decltype(func(CancelToken()))>;
+
+  CancelToken GetToken() const;
+  void Reserve(size_t workerCount);
+  bool Shutdown(std::chrono::milliseconds timeout);
 
 private:
 
-  AsyncMgr();
+  AsyncMgr(size_t workerCount);
   ~AsyncMgr();
 
-  struct AsyncEntry
+  bool Enqueue(std::function<void()> task);
+  void WorkerLoop();
+
+  CancelToken Token;
+  std::mutex QueueLock;
+  std::condition_variable QueueEvent;
+  std::condition_variable ExitEvent;
+  std::deque<std::function<void()>> Queue;
+  std::vector<std::thread> Workers;
+  size_t RunningWorkers;
+  bool Stopping;
+};
+
+template <typename Func>
+auto AsyncMgr::Spawn(Func func) -> std::future<decltype(func(CancelToken()))>
+{
+  return Spawn(func, Token);
+}
+
+template <typename Func>
+auto AsyncMgr::Spawn(Func func, CancelToken token) -> std::future<decltype(func(CancelToken()))>
+{
+  typedef decltype(func(CancelToken())) Result;
+
+  // A task that is never run (rejected, or dropped at shutdown) leaves its
+  // future with a broken_promise error instead of blocking forever.
+  std::shared_ptr<std::packaged_task<Result()>> task =
+    std::make_shared<std::packaged_task<Result()>>([func, token]() mutable
+    {
+      return func(token);
+    });
+
+  std::future<Result> result = task->get_future();
+  Enqueue([task]()
   {
-    bool  kill_flag;
-    void* handle;
-  };
+    (*task)();
+  });
 
-  std::map<uintptr_t, AsyncEntry> AsyncMap;
-};
\ No newline at end of file
+  return result;
+}
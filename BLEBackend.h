@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// BLE stack abstraction used by LightHouse and LHV2Mgr. SimpleBLEBackend
+// talks to real hardware, SimBLEBackend simulates a fleet of stations.
+//
+// Failures are reported the way SimpleBLE reports them, by throwing, so
+// callers handle both backends with the same try/catch.
+
+class BLEPeripheral
+{
+public:
+
+  typedef std::function<void(std::string payload)> PayloadCallback;
+
+  virtual ~BLEPeripheral() {}
+
+  virtual std::string GetIdentifier() = 0;
+  virtual std::string GetAddress() = 0;
+  virtual int16_t GetRssi() = 0;
+  virtual bool IsConnected() = 0;
+  virtual void Connect() = 0;
+  virtual void Disconnect() = 0;
+
+  // Every service/characteristic pair the device exposes
+  virtual std::vector<std::pair<std::string, std::string>> GetCharacteristics() = 0;
+
+  virtual std::string Read(const std::string& service, const std::string& characteristic) = 0;
+  virtual void WriteRequest(const std::string& service,
+                            const std::string& characteristic,
+                            const std::string& value) = 0;
+  virtual void WriteCommand(const std::string& service,
+                            const std::string& characteristic,
+                            const std::string& value) = 0;
+  virtual void Notify(const std::string& service,
+                      const std::string& characteristic,
+                      PayloadCallback cb) = 0;
+  virtual void Indicate(const std::string& service,
+                        const std::string& characteristic,
+                        PayloadCallback cb) = 0;
+  virtual void Unsubscribe(const std::string& service, const std::string& characteristic) = 0;
+  virtual void SetDisconnectedCallback(std::function<void()> cb) = 0;
+};
+
+class BLEAdapter
+{
+public:
+
+  // Invoked from the backend's thread for every device the scan finds
+  typedef std::function<void(std::shared_ptr<BLEPeripheral> peripheral)> ScanCallback;
+
+  virtual ~BLEAdapter() {}
+
+  virtual std::string GetIdentifier() = 0;
+  virtual void SetScanFoundCallback(ScanCallback cb) = 0;
+  virtual void ScanStart() = 0;
+  virtual void ScanStop() = 0;
+};
+
+class BLEBackend
+{
+public:
+
+  virtual ~BLEBackend() {}
+
+  virtual bool IsBluetoothEnabled() = 0;
+  virtual std::vector<std::shared_ptr<BLEAdapter>> GetAdapters() = 0;
+};
@@ -1,9 +1,15 @@
 #include "BaseStation.h"
+#include "Metrics.h"
+#include "SimBLEBackend.h"
+#include "SimpleBLEBackend.h"
+#include "Trace.h"
+#include <QApplication>
+#include <QHeaderView>
 #include <QMenu>
 #include <QMessageBox>
 #include <QMovie>
 #include <QSystemTrayIcon>
-#include <QTimer>
+#include <cstdlib>
 #pragma comment(lib, "simpleble.lib")
 
 BaseStation* BaseStation::MyInstance = nullptr;
@@ -30,6 +36,44 @@ void BaseStation::LHV2AlertCallback(LHV2Mgr::AlertEnum alert, void* pParams)
   case LHV2Mgr::READY:
     emit BaseStation::Instance()->drawSignal(BaseStation::RUNNING_ID);
     break;
+  case LHV2Mgr::DISCOVERY_COMPLETE:
+    {
+      const LHV2Mgr::DiscoveryReport* report = 
+        reinterpret_cast<const LHV2Mgr::DiscoveryReport*>(pParams);
+
+      char tempBuf[128] = { 0 };
+      sprintf_s(tempBuf,
+                "Found %zu Base Station(s) in %lld ms\n(%s start, %zu cached)",
+                report->Found,
+                static_cast<long long>(report->Elapsed.count()),
+                (true == report->Warm) ? "warm" : "cold",
+                report->Cached);
+      BaseStation::Instance()->SetStatus(tempBuf);
+    }
+    break;
+  case LHV2Mgr::COMMAND_REJECTED:
+    BaseStation::Instance()->SetStatus(
+      reinterpret_cast<const LHV2Mgr::CommandRejection*>(pParams)->Reason);
+    break;
+  case LHV2Mgr::PRE_WAKE_COMPLETE:
+    {
+      const LHV2Mgr::PreWakeReport* report =
+        reinterpret_cast<const LHV2Mgr::PreWakeReport*>(pParams);
+
+      char tempBuf[128] = { 0 };
+      sprintf_s(tempBuf,
+                "Base Station(s) %s when SteamVR started\n"
+                "Woken %lld ms early, %lld ms saved",
+                (true == report->Ready) ? "ready" : "booting",
+                static_cast<long long>(report->Lead.count()),
+                static_cast<long long>(report->Saved.count()));
+      BaseStation::Instance()->SetStatus(tempBuf);
+    }
+    break;
+  case LHV2Mgr::DEVICES_CHANGED:
+    BaseStation::Instance()->Devices->PostChanges(
+      *reinterpret_cast<const LHV2Mgr::DeviceChanges*>(pParams));
+    break;
   case LHV2Mgr::VR_ACTIVE:
     emit BaseStation::Instance()->drawSignal(BaseStation::VR_ID);
     break;
@@ -41,23 +85,50 @@ void BaseStation::LHV2AlertCallback(LHV2Mgr::AlertEnum alert, void* pParams)
     BaseStation::Instance()->SetStatus("Powering on Base Station(s)");
     emit BaseStation::Instance()->drawSignal(BaseStation::LOAD_ID);
     break;
+  case LHV2Mgr::POWER_COMPLETE:
+    {
+      const LHV2Mgr::PowerReport* report = 
+        reinterpret_cast<const LHV2Mgr::PowerReport*>(pParams);
+
+      size_t succeeded = 0;
+      for (size_t i = 0; i < report->Results.size(); ++i)
+      {
+        succeeded += (true == report->Results[i].Success) ? 1 : 0;
+      }
+
+      char tempBuf[160] = { 0 };
+      sprintf_s(tempBuf, 
+                "Powered %s %zu/%zu Base Station(s) in %lld ms\n"
+                "First write %lld ms after command",
+                (true == report->PowerOn) ? "on" : 
+                (true == report->Standby) ? "to standby" : "off",
+                succeeded,
+                report->Results.size(),
+                static_cast<long long>(report->Elapsed.count()),
+                static_cast<long long>(report->CommandLatency.count()));
+      BaseStation::Instance()->SetStatus(tempBuf);
+    }
+    break;
   }
 }
 
-void BaseStation::statusSlot(const char* status)
+void BaseStation::statusSlot(const QString& status)
 {
   ui.StatusLabel->setText(status);
-  delete[] status;
 }
 
 void BaseStation::drawSlot(int drawType)
 {
-  StatusTimer->stop();
+  // READY and VR_ACTIVE arrive on every poll, only redraw on a change
+  if (DrawState == drawType)
+  {
+    return;
+  }
 
+  DrawState = drawType;
   switch (drawType)
   {
   case LOAD_ID:
-    BaseStation::Instance()->StatusList.clear();
     ui.DisplayLabel->setMovie(ScanningMovie);
     ProcessingMovie->stop();
     ScanningMovie->start();
@@ -66,8 +137,6 @@ void BaseStation::drawSlot(int drawType)
     ui.DisplayLabel->setMovie(ProcessingMovie);
     ProcessingMovie->start();
     ScanningMovie->stop();
-    processScan();
-    StatusTimer->start();
     break;
   case VR_ID:
     SetStatus("SteamVR Active");
@@ -75,37 +144,6 @@ void BaseStation::drawSlot(int drawType)
   }
 }
 
-void BaseStation::processScan()
-{
-  // Build status list
-  std::vector<LightHouse*> devices = LighthouseV2Mgr->GetLighthouses();
-
-  char tempBuf[512] = { 0 };
-
-  StatusList.clear();
-  sprintf_s(tempBuf, "Managing %zd Base Station(s)", devices.size());
-  StatusList.push_back(tempBuf);
-
-  for (size_t i = 0; i < devices.size(); ++i)
-  {
-    sprintf_s(tempBuf,
-              "Identifier: %s\nAddress: %s\nStatus: %s\n",
-              devices[i]->GetIdentifier().c_str(),
-              devices[i]->GetAddress().c_str(),
-              devices[i]->GetStatus().c_str());
-    StatusList.push_back(tempBuf);
-  }
-}
-
-void BaseStation::statusTimerSlot()
-{
-  static uint32_t tick = 0;
-  if (0 != StatusList.size())
-  {
-    SetStatus(StatusList[tick++ % StatusList.size()]);
-  }
-}
-
 void BaseStation::refreshSlot()
 {
   LighthouseV2Mgr->RefreshDevices();
@@ -147,24 +185,23 @@ void BaseStation::closeEvent(QCloseEvent* closeEvent)
 
 void BaseStation::SetStatus(std::string status)
 {
-  char* pBuf = new char[status.length() + 1];
-  memset(pBuf, 0, status.length() + 1);
-  memcpy(pBuf, status.c_str(), status.length());
-
-  emit statusSignal(pBuf);
+  emit statusSignal(QString::fromStdString(status));
 }
 
 BaseStation::BaseStation(QWidget *parent) : 
-  QMainWindow(parent)
+  QMainWindow(parent),
+  DrawState(-1)
 {
   ui.setupUi(this);
   MyInstance = this;
   setWindowIcon(QIcon(QPixmap(":/new/prefix1/resources/trayicon.png")));
 
-  StatusTimer = new QTimer(this);
-  StatusTimer->setSingleShot(false);
-  StatusTimer->setInterval(std::chrono::milliseconds(3000));
-  connect(StatusTimer, &QTimer::timeout, this, &BaseStation::statusTimerSlot);
+  // Every station at once, rows only repaint when the manager says they moved
+  Devices = new DeviceTableModel(this);
+  ui.DeviceTable->setModel(Devices);
+  ui.DeviceTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+  ui.DeviceTable->horizontalHeader()->setStretchLastSection(true);
+  ui.DeviceTable->verticalHeader()->setVisible(false);
   connect(this, &BaseStation::statusSignal, this, &BaseStation::statusSlot);
   connect(this, &BaseStation::drawSignal, this, &BaseStation::drawSlot);
 
@@ -205,19 +242,66 @@ BaseStation::BaseStation(QWidget *parent) :
   connect(action, &QAction::triggered, this, &BaseStation::powerOffSlot);
   TrayMenu->addSeparator();
   action = TrayMenu->addAction("Exit");
-  connect(action, &QAction::triggered, this, [this](){ exit(0); });
+  connect(action, &QAction::triggered, this, [this](){ QApplication::quit(); });
   TrayIcon = new QSystemTrayIcon(QIcon(QPixmap(":/new/prefix1/resources/trayicon.png")));
   TrayIcon->setContextMenu(TrayMenu);
 
   // Configure GIFs and Lighthouse manager
   ProcessingMovie = new QMovie(":/new/prefix1/resources/processing.gif");
   ScanningMovie = new QMovie(":/new/prefix1/resources/loading.gif");
-  LighthouseV2Mgr = LHV2Mgr::Create(LHV2AlertCallback);
+
+  // VBSC_TRACE=<file> records every BLE connect/read/write to that file
+  const char* tracePath = std::getenv("VBSC_TRACE");
+  if (nullptr != tracePath)
+  {
+    Trace::StartFileDrain(tracePath);
+  }
+
+  // VBSC_METRICS_PORT=<port> serves Prometheus metrics on 127.0.0.1:<port>
+  const char* metricsPort = std::getenv("VBSC_METRICS_PORT");
+  if ((nullptr != metricsPort) && (0 < std::atoi(metricsPort)))
+  {
+    Metrics::StartListener(static_cast<uint16_t>(std::atoi(metricsPort)));
+  }
+
+  // VBSC_SIMULATE=<count> runs against simulated stations instead of Bluetooth
+  std::shared_ptr<BLEBackend> backend = std::make_shared<SimpleBLEBackend>();
+  const char* simulate = std::getenv("VBSC_SIMULATE");
+  if ((nullptr != simulate) && (0 < std::atoi(simulate)))
+  {
+    backend = std::make_shared<SimBLEBackend>(SimBLEBackend::DefaultConfig(std::atoi(simulate)));
+  }
+
+  LighthouseV2Mgr = LHV2Mgr::Create(LHV2AlertCallback, backend);
+
+  // VBSC_STANDBY=1 powers off to standby, for a faster wake next session
+  const char* standby = std::getenv("VBSC_STANDBY");
+  if ((nullptr != standby) && (0 < std::atoi(standby)))
+  {
+    LighthouseV2Mgr->SetStandbyPolicy(true);
+  }
+
+  // VBSC_PREWAKE=1 powers on as soon as SteamVR's launcher or server starts
+  const char* preWake = std::getenv("VBSC_PREWAKE");
+  if ((nullptr != preWake) && (0 < std::atoi(preWake)))
+  {
+    LighthouseV2Mgr->SetPreWake(true);
+  }
+
+  // VBSC_MAX_POLL_MS=<ms> caps how far polling backs off while nothing changes
+  const char* maxPoll = std::getenv("VBSC_MAX_POLL_MS");
+  if ((nullptr != maxPoll) && (0 < std::atoi(maxPoll)))
+  {
+    LighthouseV2Mgr->SetMaxPollInterval(std::chrono::milliseconds(std::atoi(maxPoll)));
+  }
+
   LighthouseV2Mgr->RefreshDevices();
 }
 
 BaseStation::~BaseStation()
 {
+  LHV2Mgr::Destroy(LighthouseV2Mgr);
+  Metrics::StopListener();
   delete ScanningMovie;
   delete ProcessingMovie;
 }
@@ -3,12 +3,12 @@
 #include <QCloseEvent>
 #include <QMainWindow>
 #include "ui_BaseStation.h"
+#include "DeviceTableModel.h"
 #include "LHV2Mgr.h"
 
 class QMenu;
 class QMovie;
 class QSystemTrayIcon;
-class QTimer;
 
 class BaseStation : public QMainWindow
 {
@@ -29,14 +29,12 @@ public:
   ~BaseStation();
 
 signals:
-  void statusSignal(const char* status);
+  void statusSignal(const QString& status);
   void drawSignal(int drawType);
-  void processScanSignal();
 
 public slots:
-  void statusSlot(const char* status);
+  void statusSlot(const QString& status);
   void drawSlot(int drawType);
-  void statusTimerSlot();
   void refreshSlot();
   void powerOnSlot();
   void powerOffSlot();
@@ -44,7 +42,6 @@ public slots:
 private:
 
   void closeEvent(QCloseEvent* closeEvent) override;
-  void processScan();
   static void LHV2AlertCallback(LHV2Mgr::AlertEnum alert, void* pParams);
 
   Ui::BaseStationClass ui;
@@ -52,8 +49,8 @@ private:
   LHV2Mgr* LighthouseV2Mgr;
   QMovie* ScanningMovie;
   QMovie* ProcessingMovie;
-  QTimer* StatusTimer;
+  DeviceTableModel* Devices;
+  int DrawState;
   QSystemTrayIcon* TrayIcon;
   QMenu* TrayMenu;
-  std::vector<std::string> StatusList;
 };
@@ -0,0 +1,83 @@
+#include "CommandQueue.h"
+
+static_assert(0 == (CommandQueue::CAPACITY & (CommandQueue::CAPACITY - 1)),
+              "CommandQueue::CAPACITY must be a power of two");
+static_assert(CommandQueue::COMMAND_COUNT <= CommandQueue::CAPACITY,
+              "CommandQueue::CAPACITY must hold one of each command");
+
+
+CommandQueue::CommandQueue() :
+  EnqueuePos(0),
+  DequeuePos(0),
+  InFlight(0)
+{
+  for (size_t i = 0; i < CAPACITY; ++i)
+  {
+    Slots[i].Sequence.store(i, std::memory_order_relaxed);
+    Slots[i].Command = REFRESH;
+  }
+}
+
+CommandQueue::PushResult CommandQueue::Push(CommandEnum command)
+{
+  // Claim the command, if it's already queued or running this push
+  // is folded into that one.
+  uint32_t bit = 1u << command;
+  if (0 != (InFlight.fetch_or(bit, std::memory_order_acq_rel) & bit))
+  {
+    return COLLAPSED;
+  }
+
+  // Bounded MPMC ring (Vyukov), each slot's sequence says whose turn it is
+  size_t pos = EnqueuePos.load(std::memory_order_relaxed);
+  Slot* slot = nullptr;
+  for (;;)
+  {
+    slot = &Slots[pos & (CAPACITY - 1)];
+    size_t sequence = slot->Sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+    if (0 == diff)
+    {
+      if (true == EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (0 > diff)
+    {
+      InFlight.fetch_and(~bit, std::memory_order_acq_rel);
+      return REJECTED;
+    }
+    else
+    {
+      pos = EnqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->Command = command;
+  slot->Sequence.store(pos + 1, std::memory_order_release);
+
+  return QUEUED;
+}
+
+bool CommandQueue::Pop(CommandEnum& command)
+{
+  Slot& slot = Slots[DequeuePos & (CAPACITY - 1)];
+  size_t sequence = slot.Sequence.load(std::memory_order_acquire);
+  if (sequence != DequeuePos + 1)
+  {
+    return false;
+  }
+
+  command = slot.Command;
+  slot.Sequence.store(DequeuePos + CAPACITY, std::memory_order_release);
+  ++DequeuePos;
+
+  return true;
+}
+
+void CommandQueue::Complete(CommandEnum command)
+{
+  InFlight.fetch_and(~(1u << command), std::memory_order_acq_rel);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free multi-producer/single-consumer queue of user commands. Each
+// command is single-flight: while one is queued or being executed, pushing
+// the same command again collapses into it instead of queueing a repeat.
+class CommandQueue
+{
+public:
+
+  enum CommandEnum
+  {
+    REFRESH,
+    POWER_ON,
+    POWER_OFF,
+    COMMAND_COUNT
+  };
+
+  enum PushResult
+  {
+    QUEUED,
+    COLLAPSED,
+    REJECTED
+  };
+
+  // Power of two, and at least COMMAND_COUNT so single-flight commands
+  // can never fill it.
+  static const size_t CAPACITY = 8;
+
+  CommandQueue();
+
+  // Producers (any thread)
+  PushResult Push(CommandEnum command);
+
+  // Consumer (the scan loop only)
+  bool Pop(CommandEnum& command);
+  void Complete(CommandEnum command);
+
+private:
+
+  struct Slot
+  {
+    std::atomic<size_t> Sequence;
+    CommandEnum Command;
+  };
+
+  Slot Slots[CAPACITY];
+  std::atomic<size_t> EnqueuePos;
+  size_t DequeuePos;
+  std::atomic<uint32_t> InFlight;
+};
@@ -0,0 +1,149 @@
+#include "DeviceTableModel.h"
+
+namespace
+{
+  const char* COLUMN_NAMES[DeviceTableModel::COLUMN_COUNT] =
+  {
+    "Station",
+    "Address",
+    "Power",
+    "Link",
+    "Health",
+    "Wake"
+  };
+}
+
+
+DeviceTableModel::DeviceTableModel(QObject* parent) :
+  QAbstractTableModel(parent),
+  PendingReset(false),
+  ApplyQueued(false)
+{
+}
+
+void DeviceTableModel::PostChanges(const LHV2Mgr::DeviceChanges& changes)
+{
+  // Runs on the scan loop's thread, everything it needs is copied here
+  std::lock_guard<std::mutex> lock(PendingLock);
+  PendingDevices = changes.Devices;
+  PendingReset = PendingReset || changes.Reset;
+  PendingRows.resize(changes.Devices->size(), false);
+  for (size_t i = 0; i < changes.Changed.size(); ++i)
+  {
+    PendingRows[changes.Changed[i]] = true;
+  }
+
+  // Changes that arrive before the GUI thread gets around to it are merged
+  if (false == ApplyQueued)
+  {
+    ApplyQueued = true;
+    QMetaObject::invokeMethod(this, &DeviceTableModel::applyChanges, Qt::QueuedConnection);
+  }
+}
+
+int DeviceTableModel::rowCount(const QModelIndex& parent) const
+{
+  return (true == parent.isValid()) ? 0 : static_cast<int>(Rows.size());
+}
+
+int DeviceTableModel::columnCount(const QModelIndex& parent) const
+{
+  return (true == parent.isValid()) ? 0 : COLUMN_COUNT;
+}
+
+QVariant DeviceTableModel::data(const QModelIndex& index, int role) const
+{
+  if ((false == index.isValid()) || (Qt::DisplayRole != role))
+  {
+    return QVariant();
+  }
+
+  return Rows[index.row()][index.column()];
+}
+
+QVariant DeviceTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+  if ((Qt::Horizontal != orientation) || (Qt::DisplayRole != role) ||
+      (0 > section) || (COLUMN_COUNT <= section))
+  {
+    return QVariant();
+  }
+
+  return QString(COLUMN_NAMES[section]);
+}
+
+void DeviceTableModel::applyChanges()
+{
+  LHV2Mgr::DeviceList devices;
+  bool reset = false;
+  {
+    std::lock_guard<std::mutex> lock(PendingLock);
+    devices.swap(PendingDevices);
+    reset = PendingReset;
+    PendingReset = false;
+    ApplyQueued = false;
+
+    DirtyRows.clear();
+    for (size_t i = 0; i < PendingRows.size(); ++i)
+    {
+      if (true == PendingRows[i])
+      {
+        DirtyRows.push_back(i);
+        PendingRows[i] = false;
+      }
+    }
+  }
+
+  if (nullptr == devices)
+  {
+    return;
+  }
+
+  if (true == reset)
+  {
+    beginResetModel();
+    Rows.resize(devices->size());
+    for (size_t i = 0; i < devices->size(); ++i)
+    {
+      FormatRow((*devices)[i], Rows[i]);
+    }
+    endResetModel();
+    return;
+  }
+
+  for (size_t i = 0; i < DirtyRows.size(); ++i)
+  {
+    int row = static_cast<int>(DirtyRows[i]);
+    FormatRow((*devices)[row], Rows[row]);
+    emit dataChanged(index(row, 0), index(row, COLUMN_COUNT - 1));
+  }
+}
+
+void DeviceTableModel::FormatRow(const LHV2Mgr::DeviceSnapshot& device, Row& row) const
+{
+  row[STATION_COL] = QString::fromStdString(device.Identifier);
+  row[ADDRESS_COL] = QString::fromStdString(device.Address);
+  row[POWER_COL] = QString::fromStdString(device.Status);
+  row[LINK_COL] = (true == device.Subscribed) ? QString("push") : QString("poll");
+
+  switch (device.Health.State)
+  {
+  case LightHouse::HEALTHY:
+    row[HEALTH_COL] = "healthy";
+    break;
+  case LightHouse::DEGRADED:
+    row[HEALTH_COL] = QString("degraded (%1)").arg(device.Health.Failures);
+    break;
+  case LightHouse::UNREACHABLE:
+    row[HEALTH_COL] = "unreachable";
+    break;
+  }
+
+  row[WAKE_COL].clear();
+  if (0 < device.Wake.Elapsed.count())
+  {
+    row[WAKE_COL] = QString("%1 ms from %2")
+                      .arg(static_cast<qlonglong>(device.Wake.Elapsed.count()))
+                      .arg(LightHouse::GetPowerStateName(device.Wake.From));
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QAbstractTableModel>
+#include <QString>
+#include <array>
+#include <mutex>
+#include <vector>
+#include "LHV2Mgr.h"
+
+// One row per station, fed by LHV2Mgr's DEVICES_CHANGED alerts. Changes
+// posted from the scan loop are merged until the GUI thread gets to them,
+// then only the rows that moved are reformatted and repainted.
+class DeviceTableModel : public QAbstractTableModel
+{
+  Q_OBJECT
+
+public:
+  enum ColumnEnum
+  {
+    STATION_COL,
+    ADDRESS_COL,
+    POWER_COL,
+    LINK_COL,
+    HEALTH_COL,
+    WAKE_COL,
+    COLUMN_COUNT
+  };
+
+  DeviceTableModel(QObject* parent = nullptr);
+
+  void PostChanges(const LHV2Mgr::DeviceChanges& changes);
+
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+  QVariant headerData(int section, Qt::Orientation orientation,
+                      int role = Qt::DisplayRole) const override;
+
+private slots:
+  void applyChanges();
+
+private:
+
+  typedef std::array<QString, COLUMN_COUNT> Row;
+
+  void FormatRow(const LHV2Mgr::DeviceSnapshot& device, Row& row) const;
+
+  // Written by the scan loop, drained by applyChanges()
+  std::mutex PendingLock;
+  LHV2Mgr::DeviceList PendingDevices;
+  std::vector<bool> PendingRows;
+  bool PendingReset;
+  bool ApplyQueued;
+
+  // GUI thread only
+  std::vector<size_t> DirtyRows;
+  std::vector<Row> Rows;
+};
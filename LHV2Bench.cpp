@@ -0,0 +1,727 @@
+#include "LHV2Mgr.h"
+#include "Metrics.h"
+#include "SimBLEBackend.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Drives LHV2Mgr against a simulated fleet and reports latency percentiles
+// for discovery, the power on/off cycles and the steady-state poll tick.
+//
+//   LHV2Bench [--stations 1,4,16,64] [--iterations 3] [--ticks 3]
+//             [--time-scale 0.1] [--seed 1] [--notify] [--adapters 1]
+//             [--out results.json]
+//             [--trace trace.txt] [--metrics-port 9464]
+//
+// toggle_* break power_on/power_off down per device: the whole toggle and
+// the time spent connecting, writing and verifying. After the off cycle the
+// stations go to standby and are woken again; ready_sleep and ready_standby
+// are the per station times from the wake write to tracking. Without
+// --notify they include up to one poll interval before the manager sees it.
+// With --notify each session ends by rescanning and dropping every link,
+// the run fails if a station isn't polled again afterwards.
+//
+// The simulator runs time-scaled, latencies are reported in simulated time
+// so runs at different scales stay comparable. Results go to stdout (or
+// --out) as JSON, a summary table goes to stderr.
+
+namespace
+{
+
+const uint32_t ALERT_TIMEOUT_MS = 120000;
+const uint32_t READY_TIMEOUT_MS = 30000;   // Simulated
+
+struct BenchConfig
+{
+  std::vector<size_t> Stations;
+  size_t Iterations;
+  size_t Ticks;
+  double TimeScale;
+  uint32_t Seed;
+  bool Notify;
+  size_t Adapters;
+  std::string OutPath;
+  std::string TracePath;
+  uint16_t MetricsPort;
+};
+
+// Alerts arrive on the scan loop's thread, the bench waits on them here
+struct AlertLog
+{
+  std::mutex Lock;
+  std::condition_variable Event;
+  std::vector<LHV2Mgr::DiscoveryReport> Discoveries;
+  std::vector<LHV2Mgr::PowerReport> PowerReports;
+  std::vector<LHV2Mgr::PollReport> Polls;
+};
+
+AlertLog Alerts;
+
+void BenchAlertCallback(const LHV2Mgr::AlertEnum alert, void* pDetails)
+{
+  std::lock_guard<std::mutex> lock(Alerts.Lock);
+  switch (alert)
+  {
+  case LHV2Mgr::DISCOVERY_COMPLETE:
+    Alerts.Discoveries.push_back(*reinterpret_cast<LHV2Mgr::DiscoveryReport*>(pDetails));
+    break;
+  case LHV2Mgr::POWER_COMPLETE:
+    Alerts.PowerReports.push_back(*reinterpret_cast<LHV2Mgr::PowerReport*>(pDetails));
+    break;
+  case LHV2Mgr::POLL_COMPLETE:
+    Alerts.Polls.push_back(*reinterpret_cast<LHV2Mgr::PollReport*>(pDetails));
+    break;
+  default:
+    return;
+  }
+
+  Alerts.Event.notify_all();
+}
+
+template <typename Predicate>
+bool WaitForAlert(Predicate predicate)
+{
+  std::unique_lock<std::mutex> lock(Alerts.Lock);
+  return Alerts.Event.wait_for(lock, std::chrono::milliseconds(ALERT_TIMEOUT_MS), predicate);
+}
+
+void ClearAlerts()
+{
+  std::lock_guard<std::mutex> lock(Alerts.Lock);
+  Alerts.Discoveries.clear();
+  Alerts.PowerReports.clear();
+  Alerts.Polls.clear();
+}
+
+// Samples of one scenario at one fleet size, in simulated milliseconds.
+// Work is what the throughput is counted in (stations handled).
+struct Series
+{
+  std::string Scenario;
+  size_t Stations;
+  std::vector<double> SamplesMs;
+  double Work;
+};
+
+// The power cycle through standby
+struct WakeSeries
+{
+  Series* Standby;
+  Series* PowerOn;
+  Series* ReadySleep;
+  Series* ReadyStandby;
+};
+
+// Per-device power toggles, in total and by phase
+struct ToggleSeries
+{
+  Series* Device;
+  Series* Connect;
+  Series* Write;
+  Series* Verify;
+};
+
+// A fresh empty file for the station cache, so the bench never touches the
+// user's own
+std::string CreateTempFile()
+{
+#ifdef _WIN32
+  char dir[MAX_PATH + 1] = { 0 };
+  char path[MAX_PATH + 1] = { 0 };
+  if ((0 == GetTempPathA(sizeof(dir), dir)) ||
+      (0 == GetTempFileNameA(dir, "LHV", 0, path)))
+  {
+    return std::string();
+  }
+
+  return path;
+#else
+  char path[] = "/tmp/LHV2Bench.XXXXXX";
+  int fd = mkstemp(path);
+  if (-1 == fd)
+  {
+    return std::string();
+  }
+
+  close(fd);
+  return path;
+#endif
+}
+
+double Percentile(const std::vector<double>& sorted, double p)
+{
+  if (true == sorted.empty())
+  {
+    return 0;
+  }
+
+  // Nearest rank
+  size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+class Bench
+{
+public:
+
+  Bench(const BenchConfig& config, const std::string& cachePath) :
+    Config(config),
+    CachePath(cachePath)
+  {
+  }
+
+  bool Run()
+  {
+    for (size_t s = 0; s < Config.Stations.size(); ++s)
+    {
+      size_t stations = Config.Stations[s];
+      Series& discovery = AddSeries("discovery", stations);
+      Series& warm = AddSeries("discovery_warm", stations);
+      Series& poll = AddSeries("poll_tick", stations);
+      Series& powerOn = AddSeries("power_on", stations);
+      Series& powerOff = AddSeries("power_off", stations);
+      Series& standby = AddSeries("standby", stations);
+      Series& powerOnStandby = AddSeries("power_on_standby", stations);
+      Series& readySleep = AddSeries("ready_sleep", stations);
+      Series& readyStandby = AddSeries("ready_standby", stations);
+
+      ToggleSeries toggle;
+      toggle.Device = &AddSeries("toggle_device", stations);
+      toggle.Connect = &AddSeries("toggle_connect", stations);
+      toggle.Write = &AddSeries("toggle_write", stations);
+      toggle.Verify = &AddSeries("toggle_verify", stations);
+
+      for (size_t i = 0; i < Config.Iterations; ++i)
+      {
+        WakeSeries wake;
+        wake.Standby = &standby;
+        wake.PowerOn = &powerOnStandby;
+        wake.ReadySleep = &readySleep;
+        wake.ReadyStandby = &readyStandby;
+        if (false == RunIteration(stations, static_cast<uint32_t>(Config.Seed + i),
+                                  discovery, warm, poll, powerOn, powerOff, toggle, wake))
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  std::string ToJson() const
+  {
+    std::ostringstream out;
+    out << "{\n"
+        << "  \"benchmark\": \"LHV2Bench\",\n"
+        << "  \"config\": {"
+        << "\"iterations\": " << Config.Iterations
+        << ", \"ticks\": " << Config.Ticks
+        << ", \"time_scale\": " << Config.TimeScale
+        << ", \"seed\": " << Config.Seed
+        << ", \"notify\": " << ((true == Config.Notify) ? "true" : "false")
+        << ", \"adapters\": " << Config.Adapters
+        << ", \"max_connections\": " << LHV2Mgr::DEFAULT_MAX_CONNECTIONS
+        << "},\n"
+        << "  \"results\": [\n";
+
+    for (size_t i = 0; i < Results.size(); ++i)
+    {
+      const Series& series = Results[i];
+      std::vector<double> sorted = series.SamplesMs;
+      std::sort(sorted.begin(), sorted.end());
+
+      double total = 0;
+      for (size_t n = 0; n < sorted.size(); ++n)
+      {
+        total += sorted[n];
+      }
+
+      out << "    {\"scenario\": \"" << series.Scenario << "\""
+          << ", \"stations\": " << series.Stations
+          << ", \"samples\": " << sorted.size()
+          << ", \"p50_ms\": " << Percentile(sorted, 0.50)
+          << ", \"p99_ms\": " << Percentile(sorted, 0.99)
+          << ", \"max_ms\": " << ((true == sorted.empty()) ? 0 : sorted.back())
+          << ", \"mean_ms\": " << ((true == sorted.empty()) ? 0 : total / sorted.size())
+          << ", \"throughput_per_s\": " << ((0 < total) ? series.Work * 1000.0 / total : 0)
+          << ", \"histogram_ms\": [";
+
+      // Power of two buckets, only the occupied ones
+      std::map<double, size_t> histogram;
+      for (size_t n = 0; n < sorted.size(); ++n)
+      {
+        double bound = 1;
+        while (bound < sorted[n])
+        {
+          bound *= 2;
+        }
+
+        ++histogram[bound];
+      }
+
+      for (std::map<double, size_t>::const_iterator itr = histogram.begin(); itr != histogram.end(); ++itr)
+      {
+        out << ((histogram.begin() == itr) ? "" : ", ")
+            << "{\"le\": " << itr->first << ", \"count\": " << itr->second << "}";
+      }
+
+      out << "]}" << ((i + 1 < Results.size()) ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+
+    return out.str();
+  }
+
+  void PrintSummary() const
+  {
+    fprintf(stderr, "%-16s %8s %8s %10s %10s %10s %12s\n",
+            "scenario", "stations", "samples", "p50 ms", "p99 ms", "max ms", "stations/s");
+
+    for (size_t i = 0; i < Results.size(); ++i)
+    {
+      std::vector<double> sorted = Results[i].SamplesMs;
+      std::sort(sorted.begin(), sorted.end());
+
+      double total = 0;
+      for (size_t n = 0; n < sorted.size(); ++n)
+      {
+        total += sorted[n];
+      }
+
+      fprintf(stderr, "%-16s %8zu %8zu %10.1f %10.1f %10.1f %12.2f\n",
+              Results[i].Scenario.c_str(),
+              Results[i].Stations,
+              sorted.size(),
+              Percentile(sorted, 0.50),
+              Percentile(sorted, 0.99),
+              (true == sorted.empty()) ? 0 : sorted.back(),
+              (0 < total) ? Results[i].Work * 1000.0 / total : 0);
+    }
+  }
+
+private:
+
+  Series& AddSeries(const char* scenario, size_t stations)
+  {
+    Series series;
+    series.Scenario = scenario;
+    series.Stations = stations;
+    series.Work = 0;
+    Results.push_back(series);
+    return Results.back();
+  }
+
+  // The manager's own timeouts run on the same scale as the simulator
+  LHV2Mgr* CreateManager(std::shared_ptr<BLEBackend> backend) const
+  {
+    LHV2Mgr* manager = LHV2Mgr::Create(BenchAlertCallback, backend, CachePath);
+    manager->SetScanQuietPeriod(std::chrono::milliseconds(
+      static_cast<int64_t>(LHV2Mgr::DEFAULT_SCAN_QUIET_MS * Config.TimeScale)));
+    manager->SetAdapterMergeWindow(std::chrono::milliseconds(
+      static_cast<int64_t>(LHV2Mgr::DEFAULT_ADAPTER_MERGE_MS * Config.TimeScale)));
+    manager->SetPollInterval(std::chrono::milliseconds(
+      static_cast<int64_t>(LHV2Mgr::DEFAULT_POLL_INTERVAL_MS * Config.TimeScale)));
+    manager->SetMaxPollInterval(std::chrono::milliseconds(
+      static_cast<int64_t>(LHV2Mgr::DEFAULT_MAX_POLL_INTERVAL_MS * Config.TimeScale)));
+    return manager;
+  }
+
+  static void AddSample(Series& series, double ms)
+  {
+    series.SamplesMs.push_back(ms);
+    series.Work += 1;
+  }
+
+  double Simulated(std::chrono::microseconds elapsed) const
+  {
+    return static_cast<double>(elapsed.count()) / 1000.0 / Config.TimeScale;
+  }
+
+  bool RunIteration(size_t stations, uint32_t seed,
+                    Series& discovery, Series& warm, Series& poll,
+                    Series& powerOn, Series& powerOff, ToggleSeries& toggle,
+                    WakeSeries& wake)
+  {
+    SimBLEBackend::FleetConfig fleet = SimBLEBackend::DefaultConfig(stations);
+    fleet.Seed = seed;
+    fleet.TimeScale = Config.TimeScale;
+    fleet.Profile.CanNotify = Config.Notify;
+    fleet.Adapters = Config.Adapters;
+    std::shared_ptr<SimBLEBackend> backend = std::make_shared<SimBLEBackend>(fleet);
+
+    // Cold start, then a full session
+    std::ofstream(CachePath, std::ios::trunc);
+    ClearAlerts();
+
+    LHV2Mgr* manager = CreateManager(backend);
+    manager->SetExpectedStations(stations);
+    manager->RefreshDevices();
+
+    bool ok = WaitForAlert([]() { return false == Alerts.Discoveries.empty(); });
+    if (true == ok)
+    {
+      std::lock_guard<std::mutex> lock(Alerts.Lock);
+      discovery.SamplesMs.push_back(Simulated(Alerts.Discoveries[0].Elapsed));
+      discovery.Work += static_cast<double>(Alerts.Discoveries[0].Found);
+    }
+
+    // Stations start out asleep, so polling doesn't trigger the automatic
+    // shutoff before the power cycle.
+    size_t ticks = Config.Ticks;
+    ok = ok && WaitForAlert([ticks]() { return ticks <= Alerts.Polls.size(); });
+    if (true == ok)
+    {
+      std::lock_guard<std::mutex> lock(Alerts.Lock);
+      for (size_t t = 0; t < ticks; ++t)
+      {
+        poll.SamplesMs.push_back(Simulated(Alerts.Polls[t].Elapsed));
+        poll.Work += static_cast<double>(stations);
+      }
+    }
+
+    ok = ok && RunPower(manager, true, powerOn, toggle);
+    ok = ok && WaitForReady(manager, LightHouse::POWER_SLEEP, *wake.ReadySleep);
+    ok = ok && RunPower(manager, false, powerOff, toggle);
+
+    // The same cycle through standby
+    manager->SetStandbyPolicy(true);
+    ok = ok && RunPower(manager, false, *wake.Standby, toggle);
+    ok = ok && RunPower(manager, true, *wake.PowerOn, toggle);
+    ok = ok && WaitForReady(manager, LightHouse::POWER_STANDBY, *wake.ReadyStandby);
+
+    // Subscriptions only exist with notify
+    if ((true == ok) && (true == Config.Notify))
+    {
+      ok = CheckRelink(manager, *backend, stations);
+    }
+
+    LHV2Mgr::Destroy(manager);
+
+    // Warm start from the cache the session just wrote
+    if (true == ok)
+    {
+      ClearAlerts();
+
+      manager = CreateManager(backend);
+      manager->RefreshDevices();
+
+      ok = WaitForAlert([]() { return false == Alerts.Discoveries.empty(); });
+      if (true == ok)
+      {
+        std::lock_guard<std::mutex> lock(Alerts.Lock);
+        warm.SamplesMs.push_back(Simulated(Alerts.Discoveries[0].Elapsed));
+        warm.Work += static_cast<double>(Alerts.Discoveries[0].Found);
+      }
+
+      LHV2Mgr::Destroy(manager);
+    }
+
+    if (false == ok)
+    {
+      fprintf(stderr, "Timed out waiting for the manager (%zu stations, seed %u)\n", stations, seed);
+    }
+
+    return ok;
+  }
+
+  // A rescan hears every known station again, then all links drop. Stations
+  // subscribed before must notice and be polled again, a rescan sighting
+  // must not have taken their disconnect callback away.
+  bool CheckRelink(LHV2Mgr* manager, SimBLEBackend& backend, size_t stations)
+  {
+    size_t discoveries = 0;
+    {
+      std::lock_guard<std::mutex> lock(Alerts.Lock);
+      discoveries = Alerts.Discoveries.size();
+    }
+
+    manager->SetExpectedStations(0);
+    manager->RefreshDevices();
+    if (false == WaitForAlert([discoveries]() { return discoveries < Alerts.Discoveries.size(); }))
+    {
+      return false;
+    }
+
+    size_t seen = 0;
+    {
+      std::lock_guard<std::mutex> lock(Alerts.Lock);
+      seen = Alerts.Polls.size();
+    }
+
+    for (size_t i = 0; i < backend.GetStationCount(); ++i)
+    {
+      backend.DropLink(i);
+    }
+
+    // A poll already running may have caught some of them
+    if (false == WaitForAlert([seen]() { return seen + 2 <= Alerts.Polls.size(); }))
+    {
+      return false;
+    }
+
+    size_t polled = 0;
+    {
+      std::lock_guard<std::mutex> lock(Alerts.Lock);
+      polled = Alerts.Polls[seen].Polled + Alerts.Polls[seen + 1].Polled;
+    }
+
+    if (polled < stations)
+    {
+      fprintf(stderr, "Only %zu of %zu stations were polled after their links dropped\n", polled, stations);
+      return false;
+    }
+
+    return true;
+  }
+
+  bool RunPower(LHV2Mgr* manager, bool on, Series& series, ToggleSeries& toggle)
+  {
+    size_t seen = 0;
+    {
+      std::lock_guard<std::mutex> lock(Alerts.Lock);
+      seen = Alerts.PowerReports.size();
+    }
+
+    if (true == on)
+    {
+      manager->PowerOnDevices();
+    }
+    else
+    {
+      manager->PowerOffDevices();
+    }
+
+    // The automatic shutoff may get there first, either report counts
+    size_t match = 0;
+    bool ok = WaitForAlert([seen, on, &match]()
+    {
+      for (size_t i = seen; i < Alerts.PowerReports.size(); ++i)
+      {
+        if (on == Alerts.PowerReports[i].PowerOn)
+        {
+          match = i;
+          return true;
+        }
+      }
+
+      return false;
+    });
+
+    if (true == ok)
+    {
+      std::lock_guard<std::mutex> lock(Alerts.Lock);
+      const LHV2Mgr::PowerReport& report = Alerts.PowerReports[match];
+      series.SamplesMs.push_back(Simulated(report.Elapsed));
+      series.Work += static_cast<double>(report.Results.size());
+
+      for (size_t i = 0; i < report.Results.size(); ++i)
+      {
+        const LHV2Mgr::PowerResult& result = report.Results[i];
+        AddSample(*toggle.Device, Simulated(result.Elapsed));
+        AddSample(*toggle.Connect, Simulated(result.Phases.Connect));
+        AddSample(*toggle.Write, Simulated(result.Phases.Write));
+        AddSample(*toggle.Verify, Simulated(result.Phases.Verify));
+      }
+    }
+
+    return ok;
+  }
+
+  // Collects the wake times of the stations woken from the given state. One
+  // that didn't take the write never gets there, so this gives up after a
+  // few boot times rather than failing the run.
+  bool WaitForReady(LHV2Mgr* manager, LightHouse::PowerStateEnum from, Series& series)
+  {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(static_cast<int64_t>(READY_TIMEOUT_MS * Config.TimeScale));
+
+    LHV2Mgr::DeviceList devices = manager->GetDevices();
+    for (;;)
+    {
+      size_t ready = 0;
+      for (size_t i = 0; i < devices->size(); ++i)
+      {
+        ready += (from == (*devices)[i].Wake.From) ? 1 : 0;
+      }
+
+      if ((devices->size() == ready) || (deadline <= std::chrono::steady_clock::now()))
+      {
+        break;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      devices = manager->GetDevices();
+    }
+
+    for (size_t i = 0; i < devices->size(); ++i)
+    {
+      if (from == (*devices)[i].Wake.From)
+      {
+        AddSample(series, Simulated((*devices)[i].Wake.Elapsed));
+      }
+    }
+
+    return true;
+  }
+
+  BenchConfig Config;
+  std::string CachePath;
+  std::deque<Series> Results;
+};
+
+bool ParseArgs(int argc, char** argv, BenchConfig& config)
+{
+  config.Stations = { 1, 4, 16, 64 };
+  config.Iterations = 3;
+  config.Ticks = 3;
+  config.TimeScale = 0.1;
+  config.Seed = 1;
+  config.Notify = false;
+  config.Adapters = 1;
+  config.MetricsPort = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+    if ("--notify" == arg)
+    {
+      config.Notify = true;
+      continue;
+    }
+
+    if (nullptr == value)
+    {
+      return false;
+    }
+
+    if ("--stations" == arg)
+    {
+      config.Stations.clear();
+      std::istringstream list(value);
+      std::string count;
+      while (std::getline(list, count, ','))
+      {
+        config.Stations.push_back(static_cast<size_t>(std::atoi(count.c_str())));
+      }
+    }
+    else if ("--adapters" == arg)
+    {
+      config.Adapters = static_cast<size_t>(std::atoi(value));
+    }
+    else if ("--iterations" == arg)
+    {
+      config.Iterations = static_cast<size_t>(std::atoi(value));
+    }
+    else if ("--ticks" == arg)
+    {
+      config.Ticks = static_cast<size_t>(std::atoi(value));
+    }
+    else if ("--time-scale" == arg)
+    {
+      config.TimeScale = std::atof(value);
+    }
+    else if ("--seed" == arg)
+    {
+      config.Seed = static_cast<uint32_t>(std::atoi(value));
+    }
+    else if ("--out" == arg)
+    {
+      config.OutPath = value;
+    }
+    else if ("--trace" == arg)
+    {
+      config.TracePath = value;
+    }
+    else if ("--metrics-port" == arg)
+    {
+      config.MetricsPort = static_cast<uint16_t>(std::atoi(value));
+    }
+    else
+    {
+      return false;
+    }
+
+    ++i;
+  }
+
+  return (false == config.Stations.empty()) && (0 < config.Iterations) && (0 < config.Adapters) &&
+         (0 < config.TimeScale);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  BenchConfig config;
+  if (false == ParseArgs(argc, argv, config))
+  {
+    fprintf(stderr, "usage: LHV2Bench [--stations 1,4,16,64] [--iterations 3] [--ticks 3]\n"
+                    "                 [--time-scale 0.1] [--seed 1] [--notify] [--adapters 1]\n"
+                    "                 [--out file]\n"
+                    "                 [--trace file] [--metrics-port port]\n");
+    return 2;
+  }
+
+  if ((false == config.TracePath.empty()) && (false == Trace::StartFileDrain(config.TracePath)))
+  {
+    fprintf(stderr, "Can't write trace to %s\n", config.TracePath.c_str());
+    return 2;
+  }
+
+  // Metrics are in real time, unlike the results below
+  if ((0 != config.MetricsPort) && (false == Metrics::StartListener(config.MetricsPort)))
+  {
+    fprintf(stderr, "Can't listen on port %u\n", config.MetricsPort);
+    return 2;
+  }
+
+  std::string cachePath = CreateTempFile();
+  if (true == cachePath.empty())
+  {
+    fprintf(stderr, "Can't create a temporary station cache\n");
+    return 2;
+  }
+
+  Bench bench(config, cachePath);
+  bool ok = bench.Run();
+  std::remove(cachePath.c_str());
+  Trace::StopFileDrain();
+  Metrics::StopListener();
+
+  bench.PrintSummary();
+
+  std::string json = bench.ToJson();
+  if (true == config.OutPath.empty())
+  {
+    std::cout << json;
+  }
+  else
+  {
+    std::ofstream(config.OutPath) << json;
+  }
+
+  return (true == ok) ? 0 : 1;
+}
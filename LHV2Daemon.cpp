@@ -0,0 +1,482 @@
+#include "LHV2Mgr.h"
+#include "LocalPipe.h"
+#include "Metrics.h"
+#include "SimBLEBackend.h"
+#include "SimpleBLEBackend.h"
+#include "Trace.h"
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <ShlObj.h>
+#else
+#include <csignal>
+#include <pthread.h>
+#include <thread>
+#endif
+
+// Runs LHV2Mgr without the GUI, for machines that only need the automatic
+// shutoff. Commands arrive as single lines on a local pipe only the daemon's
+// own user and administrators can open, the same binary doubles as the client.
+//
+//   LHV2Daemon run [--endpoint path] [--simulate n] [--metrics-port port] [--trace file]
+//                  [--standby] [--pre-wake] [--max-poll-ms 30000]
+//   LHV2Daemon service [options as for run]   (started by the Windows SCM)
+//   LHV2Daemon [--endpoint path] refresh|power-on|power-off|status
+//
+// The endpoint defaults to \\.\pipe\LHV2Daemon on Windows and to
+// LHV2Daemon.sock in $XDG_RUNTIME_DIR elsewhere.
+//
+// Replies start with "OK" or "ERR". status lists one station per line as
+// "<address> <identifier> <healthy|degraded|unreachable> <push|poll> <status>".
+
+namespace
+{
+
+const char* HEALTH_NAMES[] = { "healthy", "degraded", "unreachable" };
+
+struct DaemonConfig
+{
+  std::string Endpoint;
+  size_t Simulate;
+  uint16_t MetricsPort;
+  std::string TracePath;
+  bool Standby;
+  bool PreWake;
+  uint32_t MaxPollMs;
+  std::string CachePath;
+  std::string Command;
+};
+
+DaemonConfig Config;
+
+std::mutex StopLock;
+std::condition_variable StopEvent;
+bool StopRequested = false;
+
+void RequestStop()
+{
+  std::lock_guard<std::mutex> lock(StopLock);
+  StopRequested = true;
+  StopEvent.notify_all();
+}
+
+void WaitForStop()
+{
+  std::unique_lock<std::mutex> lock(StopLock);
+  StopEvent.wait(lock, []() { return StopRequested; });
+}
+
+// stderr ends up in the journal under systemd
+void Log(const char* format, ...)
+{
+  char stamp[32];
+  time_t now = time(nullptr);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+  fprintf(stderr, "%s ", stamp);
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+
+  fprintf(stderr, "\n");
+  fflush(stderr);
+}
+
+void DaemonAlertCallback(const LHV2Mgr::AlertEnum alert, void* pDetails)
+{
+  switch (alert)
+  {
+  case LHV2Mgr::BT_NOT_ENABLED:
+    Log("Bluetooth not enabled");
+    break;
+  case LHV2Mgr::NO_ADAPTERS_FOUND:
+    Log("No BLE adapters found");
+    break;
+  case LHV2Mgr::DISCOVERY_COMPLETE:
+    {
+      const LHV2Mgr::DiscoveryReport* report =
+        reinterpret_cast<const LHV2Mgr::DiscoveryReport*>(pDetails);
+      Log("Found %zu base station(s) in %lld ms (%s start, %zu cached, %zu dropped)",
+          report->Found,
+          static_cast<long long>(report->Elapsed.count()),
+          (true == report->Warm) ? "warm" : "cold",
+          report->Cached,
+          report->Dropped);
+    }
+    break;
+  case LHV2Mgr::COMMAND_REJECTED:
+    Log("Command rejected: %s",
+        reinterpret_cast<const LHV2Mgr::CommandRejection*>(pDetails)->Reason);
+    break;
+  case LHV2Mgr::POWER_ON:
+    Log("Powering on base station(s)");
+    break;
+  case LHV2Mgr::TERMINATE:
+    Log("Powering off base station(s)");
+    break;
+  case LHV2Mgr::POWER_COMPLETE:
+    {
+      const LHV2Mgr::PowerReport* report =
+        reinterpret_cast<const LHV2Mgr::PowerReport*>(pDetails);
+
+      size_t succeeded = 0;
+      for (size_t i = 0; i < report->Results.size(); ++i)
+      {
+        succeeded += (true == report->Results[i].Success) ? 1 : 0;
+      }
+
+      Log("Powered %s %zu/%zu base station(s) in %lld ms",
+          (true == report->PowerOn) ? "on" :
+          (true == report->Standby) ? "to standby" : "off",
+          succeeded,
+          report->Results.size(),
+          static_cast<long long>(report->Elapsed.count()));
+    }
+    break;
+  case LHV2Mgr::PRE_WAKE_COMPLETE:
+    {
+      const LHV2Mgr::PreWakeReport* report =
+        reinterpret_cast<const LHV2Mgr::PreWakeReport*>(pDetails);
+      Log("SteamVR started with base station(s) %s, woken %lld ms early, %lld ms saved",
+          (true == report->Ready) ? "ready" : "still booting",
+          static_cast<long long>(report->Lead.count()),
+          static_cast<long long>(report->Saved.count()));
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+std::string Reply(CommandQueue::PushResult result)
+{
+  switch (result)
+  {
+  case CommandQueue::QUEUED:
+    return "OK queued\n";
+  case CommandQueue::COLLAPSED:
+    return "OK already pending\n";
+  default:
+    return "ERR too many pending commands\n";
+  }
+}
+
+// Runs on the server's thread, everything it touches on the manager is
+// safe to call from outside the scan loop
+std::string HandleCommand(const std::string& request, void* pContext)
+{
+  LHV2Mgr* manager = reinterpret_cast<LHV2Mgr*>(pContext);
+  std::string command = request.substr(0, request.find_first_of("\r\n"));
+
+  if ("refresh" == command)
+  {
+    return Reply(manager->RefreshDevices());
+  }
+  else if ("power-on" == command)
+  {
+    return Reply(manager->PowerOnDevices());
+  }
+  else if ("power-off" == command)
+  {
+    return Reply(manager->PowerOffDevices());
+  }
+  else if ("status" == command)
+  {
+    LHV2Mgr::DeviceList devices = manager->GetDevices();
+
+    std::string response = "OK " + std::to_string(devices->size()) + " station(s)\n";
+    for (size_t i = 0; i < devices->size(); ++i)
+    {
+      const LHV2Mgr::DeviceSnapshot& device = (*devices)[i];
+      response += device.Address + " " + device.Identifier + " " +
+                  HEALTH_NAMES[device.Health.State] + " " +
+                  ((true == device.Subscribed) ? "push " : "poll ") +
+                  device.Status + "\n";
+    }
+
+    return response;
+  }
+
+  return "ERR unknown command\n";
+}
+
+int RunDaemon()
+{
+  if ((false == Config.TracePath.empty()) && (false == Trace::StartFileDrain(Config.TracePath)))
+  {
+    Log("Can't write trace to %s", Config.TracePath.c_str());
+  }
+
+  if ((0 != Config.MetricsPort) && (false == Metrics::StartListener(Config.MetricsPort)))
+  {
+    Log("Can't serve metrics on port %u", Config.MetricsPort);
+  }
+
+  std::shared_ptr<BLEBackend> backend;
+  if (0 < Config.Simulate)
+  {
+    backend = std::make_shared<SimBLEBackend>(SimBLEBackend::DefaultConfig(Config.Simulate));
+  }
+  else
+  {
+    backend = std::make_shared<SimpleBLEBackend>();
+  }
+
+  LHV2Mgr* manager = LHV2Mgr::Create(DaemonAlertCallback, backend, Config.CachePath);
+  manager->SetStandbyPolicy(Config.Standby);
+  manager->SetPreWake(Config.PreWake);
+  manager->SetMaxPollInterval(std::chrono::milliseconds(Config.MaxPollMs));
+
+  int res = 0;
+  LocalPipe* server = LocalPipe::Create(Config.Endpoint, "\n", HandleCommand, manager);
+  if (nullptr == server)
+  {
+    Log("Can't listen on %s", Config.Endpoint.c_str());
+    res = 1;
+  }
+  else
+  {
+    Log("Listening on %s", Config.Endpoint.c_str());
+    manager->RefreshDevices();
+    WaitForStop();
+    Log("Stopping");
+  }
+
+  // Nothing can reach the manager once the server is gone
+  LocalPipe::Destroy(server);
+  LHV2Mgr::Destroy(manager);
+  Metrics::StopListener();
+  Trace::StopFileDrain();
+
+  return res;
+}
+
+int RunClient()
+{
+  std::string response;
+  if (false == LocalPipe::Send(Config.Endpoint, Config.Command + "\n", response))
+  {
+    fprintf(stderr, "LHV2Daemon is not running on %s, or you may not access it\n", Config.Endpoint.c_str());
+    return 1;
+  }
+
+  fputs(response.c_str(), stdout);
+  return (0 == response.compare(0, 2, "OK")) ? 0 : 1;
+}
+
+#ifdef _WIN32
+const wchar_t* SERVICE_NAME = L"LHV2Daemon";
+SERVICE_STATUS_HANDLE ServiceHandle = nullptr;
+
+void ReportServiceState(DWORD state, DWORD exitCode)
+{
+  SERVICE_STATUS status = { 0 };
+  status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
+  status.dwCurrentState = state;
+  status.dwControlsAccepted = (SERVICE_RUNNING == state) ?
+                              (SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_SHUTDOWN) : 0;
+  status.dwWin32ExitCode = exitCode;
+  status.dwWaitHint = (SERVICE_STOP_PENDING == state) ? LHV2Mgr::SHUTDOWN_TIMEOUT_MS * 2 : 0;
+  SetServiceStatus(ServiceHandle, &status);
+}
+
+void WINAPI ServiceControl(DWORD control)
+{
+  if ((SERVICE_CONTROL_STOP == control) || (SERVICE_CONTROL_SHUTDOWN == control))
+  {
+    ReportServiceState(SERVICE_STOP_PENDING, NO_ERROR);
+    RequestStop();
+  }
+}
+
+// LocalSystem has no LOCALAPPDATA, the service keeps its cache with the
+// machine's program data instead
+std::string GetServiceCachePath()
+{
+  std::string path;
+  PWSTR folder = nullptr;
+  if (S_OK == SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr, &folder))
+  {
+    std::wstring dir = std::wstring(folder) + L"\\LHV2Daemon";
+    CreateDirectoryW(dir.c_str(), nullptr);
+
+    int size = WideCharToMultiByte(CP_ACP, 0, dir.c_str(), -1, nullptr, 0, nullptr, nullptr);
+    if (0 < size)
+    {
+      path.resize(size - 1);
+      WideCharToMultiByte(CP_ACP, 0, dir.c_str(), -1, &path[0], size, nullptr, nullptr);
+      path += "\\ValveBaseCntlr.cache";
+    }
+  }
+
+  CoTaskMemFree(folder);
+  return (true == path.empty()) ? LHV2Mgr::GetCachePath() : path;
+}
+
+void WINAPI ServiceMain(DWORD /* argc */, LPWSTR* /* argv */)
+{
+  ServiceHandle = RegisterServiceCtrlHandlerW(SERVICE_NAME, ServiceControl);
+  if (nullptr == ServiceHandle)
+  {
+    return;
+  }
+
+  ReportServiceState(SERVICE_RUNNING, NO_ERROR);
+  Config.CachePath = GetServiceCachePath();
+  int res = RunDaemon();
+  ReportServiceState(SERVICE_STOPPED, (0 == res) ? NO_ERROR : ERROR_SERVICE_SPECIFIC_ERROR);
+}
+
+BOOL WINAPI ConsoleControl(DWORD /* type */)
+{
+  RequestStop();
+  return TRUE;
+}
+
+int RunService()
+{
+  SERVICE_TABLE_ENTRYW services[] =
+  {
+    { const_cast<LPWSTR>(SERVICE_NAME), ServiceMain },
+    { nullptr, nullptr }
+  };
+
+  return (TRUE == StartServiceCtrlDispatcherW(services)) ? 0 : 1;
+}
+
+int RunForeground()
+{
+  SetConsoleCtrlHandler(ConsoleControl, TRUE);
+  return RunDaemon();
+}
+#else
+int RunService()
+{
+  // systemd and friends run us in the foreground
+  fprintf(stderr, "service is only used on Windows, use run\n");
+  return 2;
+}
+
+int RunForeground()
+{
+  // Blocked before any thread starts so only the waiter below sees them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  std::thread([signals]()
+  {
+    int signal = 0;
+    sigwait(&signals, &signal);
+    RequestStop();
+  }).detach();
+
+  return RunDaemon();
+}
+#endif
+
+bool ParseArgs(int argc, char** argv)
+{
+  Config.Endpoint = LocalPipe::DefaultPath("LHV2Daemon");
+  Config.Simulate = 0;
+  Config.MetricsPort = 0;
+  Config.Standby = false;
+  Config.PreWake = false;
+  Config.MaxPollMs = LHV2Mgr::DEFAULT_MAX_POLL_INTERVAL_MS;
+  Config.CachePath = LHV2Mgr::GetCachePath();
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (0 != arg.compare(0, 2, "--"))
+    {
+      if (false == Config.Command.empty())
+      {
+        return false;
+      }
+
+      Config.Command = arg;
+      continue;
+    }
+
+    if ("--standby" == arg)
+    {
+      Config.Standby = true;
+      continue;
+    }
+
+    if ("--pre-wake" == arg)
+    {
+      Config.PreWake = true;
+      continue;
+    }
+
+    if (i + 1 >= argc)
+    {
+      return false;
+    }
+
+    const char* value = argv[++i];
+    if ("--endpoint" == arg)
+    {
+      Config.Endpoint = value;
+    }
+    else if ("--simulate" == arg)
+    {
+      Config.Simulate = static_cast<size_t>(std::atoi(value));
+    }
+    else if ("--metrics-port" == arg)
+    {
+      Config.MetricsPort = static_cast<uint16_t>(std::atoi(value));
+    }
+    else if ("--trace" == arg)
+    {
+      Config.TracePath = value;
+    }
+    else if ("--max-poll-ms" == arg)
+    {
+      Config.MaxPollMs = static_cast<uint32_t>(std::atoi(value));
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  return (false == Config.Command.empty()) && (false == Config.Endpoint.empty());
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  if (false == ParseArgs(argc, argv))
+  {
+    fprintf(stderr, "usage: LHV2Daemon run|service [--endpoint path] [--simulate count]\n"
+                    "                  [--metrics-port port] [--trace file] [--standby]\n"
+                    "                  [--pre-wake] [--max-poll-ms 30000]\n"
+                    "       LHV2Daemon [--endpoint path] refresh|power-on|power-off|status\n");
+    return 2;
+  }
+
+  if ("run" == Config.Command)
+  {
+    return RunForeground();
+  }
+  else if ("service" == Config.Command)
+  {
+    return RunService();
+  }
+
+  return RunClient();
+}
@@ -1,246 +1,1332 @@
 #include "AsyncMgr.h"
 #include "LHV2Mgr.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <algorithm>
 #include <cassert>
-#include <simpleble/SimpleBLE.h>
+#include <cstdlib>
+#include <fstream>
+#include <list>
+#include <sstream>
+#include <unordered_set>
+
+#ifdef _WIN32
+#define NOMINMAX
 #include <Windows.h>
-#include <TlHelp32.h>
+#else
+#include <unistd.h>
+#endif
 
+namespace
+{
+  bool IsSameState(const LHV2Mgr::DeviceSnapshot& a, const LHV2Mgr::DeviceSnapshot& b)
+  {
+    return (a.Status == b.Status) &&
+           (a.Subscribed == b.Subscribed) &&
+           (a.Health.State == b.Health.State) &&
+           (a.Health.Failures == b.Health.Failures) &&
+           (a.PowerState == b.PowerState) &&
+           (a.Wake.From == b.Wake.From) &&
+           (a.Wake.Elapsed == b.Wake.Elapsed) &&
+           (a.Adapter == b.Adapter);
+  }
+}
 
 
-LHV2Mgr* LHV2Mgr::Create(AlertCallback cb)
+LHV2Mgr* LHV2Mgr::Create(AlertCallback cb,
+                         std::shared_ptr<BLEBackend> backend,
+                         const std::string& cachePath)
 {
-  LHV2Mgr* instance = new LHV2Mgr(cb);
+  LHV2Mgr* instance = new LHV2Mgr(cb, backend, cachePath);
   return instance;
 }
 
 void LHV2Mgr::Destroy(LHV2Mgr* instance)
 {
-  delete instance;
+  // A scan loop stuck in a BLE call still uses the manager and its stations
+  // once it gets going again. Such a manager is deliberately leaked, the
+  // loop only finds the cancellation and exits without alerting anyone.
+  if (true == instance->Stop())
+  {
+    delete instance;
+  }
+}
+
+CommandQueue::PushResult LHV2Mgr::RefreshDevices()
+{
+  return SubmitCommand(CommandQueue::REFRESH);
+}
+
+LHV2Mgr::DeviceList LHV2Mgr::GetDevices() const
+{
+  return std::atomic_load(&PublishedDevices);
+}
+
+CommandQueue::PushResult LHV2Mgr::PowerOnDevices()
+{
+  return SubmitCommand(CommandQueue::POWER_ON);
+}
+
+CommandQueue::PushResult LHV2Mgr::PowerOffDevices()
+{
+  return SubmitCommand(CommandQueue::POWER_OFF);
+}
+
+void LHV2Mgr::SetMaxConnections(size_t limit)
+{
+  // Per adapter, a limit of 1 reverts to one device at a time on each
+  MaxConnections = std::max<size_t>(1, limit);
+  ReserveWorkers();
+}
+
+// The fan-outs run MaxConnections workers per adapter, alongside the scan
+// loop and the probes of unreachable stations
+void LHV2Mgr::ReserveWorkers()
+{
+  AsyncMgr::Instance()->Reserve(MaxConnections * Adapters.size() + RESERVED_WORKERS);
+}
+
+void LHV2Mgr::SetIdleTimeout(std::chrono::milliseconds timeout)
+{
+  // A timeout of 0 closes links as soon as the loop next runs
+  IdleTimeoutMs = static_cast<uint32_t>(timeout.count());
+}
+
+void LHV2Mgr::SetExpectedStations(size_t count)
+{
+  // 0 means unknown, discovery then ends on the quiet period or timeout
+  ExpectedStations = count;
+}
+
+void LHV2Mgr::SetScanQuietPeriod(std::chrono::milliseconds period)
+{
+  ScanQuietMs = static_cast<uint32_t>(period.count());
+}
+
+void LHV2Mgr::SetAdapterMergeWindow(std::chrono::milliseconds window)
+{
+  AdapterMergeMs = static_cast<uint32_t>(window.count());
+}
+
+void LHV2Mgr::SetPollInterval(std::chrono::milliseconds interval)
+{
+  // Also how soon a woken station that doesn't notify is seen tracking
+  PollIntervalMs = std::max<uint32_t>(1, static_cast<uint32_t>(interval.count()));
+}
+
+void LHV2Mgr::SetMaxPollInterval(std::chrono::milliseconds interval)
+{
+  // While nothing changes the poll interval doubles up to this. Anything
+  // that moves, a command or a VR session starting or ending resets it.
+  MaxPollIntervalMs = std::max<uint32_t>(1, static_cast<uint32_t>(interval.count()));
+}
+
+void LHV2Mgr::SetPreWake(bool enable)
+{
+  // SteamVR's launcher or server appearing powers the stations on, so they
+  // boot alongside it rather than after vrmonitor is up
+  std::lock_guard<std::mutex> lock(StartupLock);
+  if ((true == enable) && (nullptr == StartupDetector) && (nullptr == FailureReason))
+  {
+    StartupDetector = VRSessionDetector::Create(VRSessionDetector::STARTUP_PROCESS_NAMES,
+                                                StartupSessionCallback,
+                                                this);
+  }
+  else if ((false == enable) && (nullptr != StartupDetector))
+  {
+    VRSessionDetector::Destroy(StartupDetector);
+    StartupDetector = nullptr;
+    SessionStarting = false;
+    PreWakePending = false;
+  }
+}
+
+void LHV2Mgr::SetStandbyPolicy(bool standby)
+{
+  // Power off, manual or automatic, leaves the stations in standby. They
+  // draw a little more while idle and are tracking again much sooner.
+  UseStandby = standby;
+}
+
+LHV2Mgr::PowerReport LHV2Mgr::DispatchPower(bool powerOn)
+{
+  PowerReport report;
+  report.PowerOn = powerOn;
+  report.Standby = (false == powerOn) && (true == UseStandby);
+  report.Results.resize(Stations.Size());
+  for (size_t i = 0; i < Stations.Size(); ++i)
+  {
+    report.Results[i].Address = Stations.At(i)->GetAddress();
+    report.Results[i].Success = false;
+    report.Results[i].Elapsed = std::chrono::milliseconds(0);
+    report.Results[i].Phases = LightHouse::PowerTimings();
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // Stations stay on the adapter that validated them. Each worker holds at
+  // most one connection and takes the next station whose adapter is below
+  // MaxConnections, so every adapter gets its own share of links however
+  // many workers the pool actually runs. A station being probed is busy on
+  // another thread and keeps its state.
+  std::mutex lock;
+  std::condition_variable event;
+  std::vector<size_t> active(Adapters.size());
+  std::deque<size_t> queue;
+  for (size_t i = 0; i < Stations.Size(); ++i)
+  {
+    if (false == IsProbing(Stations.At(i)))
+    {
+      queue.push_back(i);
+    }
+  }
+
+  std::vector<std::future<void>> workers;
+  size_t workerCount = std::min<size_t>(MaxConnections * Adapters.size(), queue.size());
+  for (size_t w = 0; w < workerCount; ++w)
+  {
+    workers.push_back(AsyncMgr::Instance()->Spawn([&](const CancelToken& token)
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      while ((false == queue.empty()) && (false == token.IsCancelled()))
+      {
+        std::deque<size_t>::iterator itr = queue.begin();
+        while ((queue.end() != itr) && (MaxConnections <= active[AdapterOf(Stations.At(*itr))]))
+        {
+          ++itr;
+        }
+
+        if (queue.end() == itr)
+        {
+          event.wait(guard);
+          continue;
+        }
+
+        size_t i = *itr;
+        size_t adapter = AdapterOf(Stations.At(i));
+        queue.erase(itr);
+        ++active[adapter];
+        guard.unlock();
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+        PowerResult& result = report.Results[i];
+        result.Success = (true == powerOn) ? Stations.At(i)->PowerOn(result.Phases) :
+                         (true == report.Standby) ? Stations.At(i)->Standby(result.Phases) :
+                                                    Stations.At(i)->PowerOff(result.Phases);
+        result.Elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() - begin);
+
+        guard.lock();
+        --active[adapter];
+        event.notify_all();
+      }
+    }, Token));
+  }
+
+  for (size_t w = 0; w < workers.size(); ++w)
+  {
+    workers[w].wait();
+  }
+
+  report.Elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start);
+
+  // Time from the command to the earliest write issued by any worker
+  std::chrono::steady_clock::time_point firstWrite = std::chrono::steady_clock::time_point::max();
+  for (size_t i = 0; i < Stations.Size(); ++i)
+  {
+    std::chrono::steady_clock::time_point written = Stations.At(i)->GetLastWriteTime();
+    if (start <= written)
+    {
+      firstWrite = std::min(firstWrite, written);
+    }
+  }
+
+  std::chrono::steady_clock::time_point command{ std::chrono::steady_clock::duration(CommandTick) };
+  report.CommandLatency = (std::chrono::steady_clock::time_point::max() == firstWrite) ?
+                          std::chrono::milliseconds(0) :
+                          std::chrono::duration_cast<std::chrono::milliseconds>(firstWrite - command);
+
+  return report;
+}
+
+LHV2Mgr::DiscoveryReport LHV2Mgr::DiscoverDevices()
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point deadline = start + std::chrono::milliseconds(SCAN_TIMEOUT_MS);
+  std::chrono::milliseconds quietPeriod(ScanQuietMs);
+
+  // Starting from the cache the scan can end as soon as every known station
+  // answered, stations that don't answer leave it running as a normal scan.
+  bool warm = (true == Stations.Empty()) && (false == KnownStations.empty());
+  size_t expected = ExpectedStations;
+  if (true == warm)
+  {
+    expected = std::max<size_t>(expected, KnownStations.size());
+  }
+
+  std::mutex lock;
+  std::condition_variable event;
+  std::list<Candidate> pending;
+  std::unordered_map<std::string, std::list<Candidate>::iterator> pendingIndex;
+  std::unordered_set<std::string> seen;
+  std::chrono::steady_clock::time_point lastFound = start;
+  size_t validating = 0;
+  bool scanning = true;
+
+  // Every adapter scans at once. Candidates are filtered as they're
+  // reported and queued for validation. With more than one adapter a
+  // candidate waits out the merge window first, so the other adapters can
+  // report it too and the one hearing it loudest gets the station.
+  const std::chrono::milliseconds mergeWindow((1 < Adapters.size()) ? AdapterMergeMs.load() : 0);
+  for (size_t a = 0; a < Adapters.size(); ++a)
+  {
+    Adapters[a]->SetScanFoundCallback([&, a](std::shared_ptr<BLEPeripheral> peripheral)
+    {
+      if (std::string::npos == peripheral->GetIdentifier().find(LightHouse::LIGHTHOUSE_ID))
+      {
+        return;
+      }
+
+      int16_t rssi = peripheral->GetRssi();
+
+      std::lock_guard<std::mutex> guard(lock);
+      if (false == scanning)
+      {
+        return;
+      }
+
+      if (false == seen.insert(peripheral->GetAddress()).second)
+      {
+        // Heard again by another adapter before validation started
+        std::unordered_map<std::string, std::list<Candidate>::iterator>::iterator itr =
+          pendingIndex.find(peripheral->GetAddress());
+        if ((pendingIndex.end() != itr) && (itr->second->Rssi < rssi))
+        {
+          itr->second->Peripheral = peripheral;
+          itr->second->Adapter = a;
+          itr->second->Rssi = rssi;
+          event.notify_all();
+        }
+
+        return;
+      }
+
+      // Stations validated by an earlier scan are kept as they are
+      if (nullptr != Stations.Get(Stations.Find(peripheral->GetAddress())))
+      {
+        return;
+      }
+
+      // Stations from the cache are taken on their first sighting, they
+      // don't need a connection to be validated
+      Candidate candidate;
+      candidate.Peripheral = peripheral;
+      candidate.Adapter = a;
+      candidate.Rssi = rssi;
+      candidate.Ready = std::chrono::steady_clock::now();
+      if (KnownStations.end() == KnownStations.find(peripheral->GetAddress()))
+      {
+        candidate.Ready += mergeWindow;
+      }
+      pendingIndex[peripheral->GetAddress()] = pending.insert(pending.end(), candidate);
+
+      lastFound = std::chrono::steady_clock::now();
+      event.notify_all();
+    });
+  }
+
+  // Validation workers, limited to MaxConnections per adapter like the
+  // power fan-out. A worker takes the oldest candidate that's past its merge
+  // window and whose adapter has a free slot.
+  std::vector<size_t> active(Adapters.size());
+  std::vector<std::future<void>> workers;
+  for (size_t w = 0; w < MaxConnections * Adapters.size(); ++w)
+  {
+    workers.push_back(AsyncMgr::Instance()->Spawn([&](const CancelToken& token)
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      for (;;)
+      {
+        // Once the scan is over nothing else will be heard, so the merge
+        // window no longer matters
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point wake = now + std::chrono::milliseconds(CANCEL_CHECK_MS);
+        std::list<Candidate>::iterator itr = pending.begin();
+        for (; pending.end() != itr; ++itr)
+        {
+          if (MaxConnections <= active[itr->Adapter])
+          {
+            continue;
+          }
+
+          if ((false == scanning) || (itr->Ready <= now))
+          {
+            break;
+          }
+
+          wake = std::min(wake, itr->Ready);
+        }
+
+        if (pending.end() == itr)
+        {
+          if ((true == pending.empty()) && (false == scanning))
+          {
+            break;
+          }
+
+          event.wait_until(guard, wake);
+          continue;
+        }
+
+        Candidate candidate = *itr;
+        pendingIndex.erase(candidate.Peripheral->GetAddress());
+        pending.erase(itr);
+        if (true == token.IsCancelled())
+        {
+          continue;
+        }
+
+        ++active[candidate.Adapter];
+        ++validating;
+        guard.unlock();
+
+        std::shared_ptr<BLEPeripheral> peripheral = candidate.Peripheral;
+        LightHouse* lighthouse = new LightHouse(peripheral->GetAddress(),
+                                                peripheral->GetIdentifier(),
+                                                peripheral);
+        lighthouse->SetCancelToken(token);
+        lighthouse->SetAdapter(candidate.Adapter);
+
+        // Known stations are validated by their cached layout alone, the
+        // first poll reads their power state. Everything else is connected
+        // to and fully enumerated.
+        std::unordered_map<std::string, KnownStation>::const_iterator known =
+          KnownStations.find(peripheral->GetAddress());
+
+        bool valid = false;
+        if (KnownStations.end() != known)
+        {
+          for (size_t i = 0; i < known->second.Characteristics.size(); ++i)
+          {
+            lighthouse->AddCharacteristic(known->second.Characteristics[i].first,
+                                          known->second.Characteristics[i].second);
+          }
+
+          valid = true;
+        }
+        else
+        {
+          valid = lighthouse->ReadCharacteristics();
+        }
+
+        if ((false == valid) || (false == lighthouse->IsValidLighthouse()))
+        {
+          delete lighthouse;
+          lighthouse = nullptr;
+        }
+
+        guard.lock();
+        if (nullptr != lighthouse)
+        {
+          lighthouse->SetStatusCallback(LighthouseStatusCallback, this);
+          Stations.Add(lighthouse);
+        }
+
+        --active[candidate.Adapter];
+        --validating;
+        event.notify_all();
+      }
+    }, Token));
+  }
+
+  for (size_t a = 0; a < Adapters.size(); ++a)
+  {
+    Adapters[a]->ScanStart();
+  }
+
+  // Stop once every expected station is validated, once nothing new has
+  // shown up for the quiet period, or at the scan timeout. Only the last
+  // two mean every station in range has had its chance to answer.
+  bool exhaustive = false;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      std::chrono::steady_clock::time_point quietUntil = lastFound + quietPeriod;
+
+      if (((0 != expected) && (expected <= Stations.Size())) ||
+          (true == Token.IsCancelled()))
+      {
+        break;
+      }
+
+      if ((deadline <= now) ||
+          ((true == pending.empty()) && (0 == validating) && (quietUntil <= now)))
+      {
+        exhaustive = true;
+        break;
+      }
+
+      // Wake periodically to notice a shutdown
+      std::chrono::steady_clock::time_point wake = 
+        (now < quietUntil) ? std::min(deadline, quietUntil) : deadline;
+      event.wait_until(guard, std::min(wake, now + std::chrono::milliseconds(CANCEL_CHECK_MS)));
+    }
+
+    scanning = false;
+    event.notify_all();
+  }
+
+  for (size_t a = 0; a < Adapters.size(); ++a)
+  {
+    Adapters[a]->ScanStop();
+    Adapters[a]->SetScanFoundCallback(nullptr);
+  }
+
+  for (size_t w = 0; w < workers.size(); ++w)
+  {
+    workers[w].wait();
+  }
+
+  // A full scan forgets unreachable stations that didn't answer it either,
+  // they've most likely been unplugged or moved out of range for good
+  size_t dropped = 0;
+  if ((true == exhaustive) && (false == Token.IsCancelled()))
+  {
+    for (size_t i = Stations.Size(); 0 < i; --i)
+    {
+      LightHouse* lighthouse = Stations.At(i - 1);
+      if ((LightHouse::UNREACHABLE == lighthouse->GetHealth().State) &&
+          (false == IsProbing(lighthouse)) &&
+          (seen.end() == seen.find(lighthouse->GetAddress())))
+      {
+        Probes.erase(lighthouse);
+        Stations.Remove(Stations.HandleAt(i - 1));
+        ++dropped;
+      }
+    }
+  }
+
+  DiscoveryReport report;
+  report.Warm = warm;
+  report.Dropped = dropped;
+  report.Cached = KnownStations.size();
+  report.Found = Stations.Size();
+  report.Elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start);
+
+  return report;
+}
+
+std::string LHV2Mgr::GetCachePath()
+{
+#ifdef _WIN32
+  const char separator = '\\';
+#else
+  const char separator = '/';
+#endif
+
+  const char* appData = std::getenv("LOCALAPPDATA");
+  if (nullptr != appData)
+  {
+    return std::string(appData) + separator + "ValveBaseCntlr.cache";
+  }
+
+  // Without a profile (a service, say) keep it next to the executable. The
+  // working directory could be anywhere, System32 for a service.
+  std::string path;
+#ifdef _WIN32
+  char module[MAX_PATH + 1] = { 0 };
+  DWORD length = GetModuleFileNameA(nullptr, module, MAX_PATH);
+  if ((0 < length) && (MAX_PATH > length))
+  {
+    path.assign(module, length);
+  }
+#else
+  char module[4096] = { 0 };
+  ssize_t length = readlink("/proc/self/exe", module, sizeof(module) - 1);
+  if (0 < length)
+  {
+    path.assign(module, static_cast<size_t>(length));
+  }
+#endif
+
+  return path.substr(0, path.find_last_of(separator) + 1) + "ValveBaseCntlr.cache";
+}
+
+void LHV2Mgr::LoadCache()
+{
+  // One station per line: address, identifier, then service=characteristic
+  // pairs, all tab separated.
+  std::ifstream cache(CachePath);
+  std::string line;
+  while (std::getline(cache, line))
+  {
+    std::istringstream fields(line);
+    KnownStation station;
+    if ((false == std::getline(fields, station.Address, '\t').fail()) &&
+        (false == std::getline(fields, station.Identifier, '\t').fail()))
+    {
+      std::string field;
+      while (std::getline(fields, field, '\t'))
+      {
+        size_t split = field.find('=');
+        Uuid128 service;
+        Uuid128 characteristic;
+        if ((std::string::npos != split) &&
+            (true == Uuid128::Parse(field.substr(0, split), service)) &&
+            (true == Uuid128::Parse(field.substr(split + 1), characteristic)))
+        {
+          station.Characteristics.push_back(std::make_pair(service, characteristic));
+        }
+      }
+
+      KnownStations[station.Address] = station;
+    }
+  }
+}
+
+void LHV2Mgr::SaveCache()
+{
+  KnownStations.clear();
+
+  std::ofstream cache(CachePath, std::ios::trunc);
+  for (size_t i = 0; i < Stations.Size(); ++i)
+  {
+    KnownStation station;
+    station.Address = Stations.At(i)->GetAddress();
+    station.Identifier = Stations.At(i)->GetIdentifier();
+    station.Characteristics = Stations.At(i)->GetCharacteristics();
+
+    cache << station.Address << '\t' << station.Identifier;
+    for (size_t c = 0; c < station.Characteristics.size(); ++c)
+    {
+      cache << '\t' << station.Characteristics[c].first.ToString()
+            << '='  << station.Characteristics[c].second.ToString();
+    }
+    cache << '\n';
+
+    KnownStations[station.Address] = station;
+  }
 }
 
-void LHV2Mgr::RefreshDevices()
+void LHV2Mgr::Wake()
 {
-  if (IDLE == DiscState)
   {
-    DiscState = SCAN;
+    std::lock_guard<std::mutex> lock(WakeLock);
+    WakePending = true;
   }
-  else if (PROCESSING == DiscState)
+
+  WakeEvent.notify_one();
+}
+
+void LHV2Mgr::WaitForWork(std::chrono::steady_clock::time_point deadline)
+{
+  std::unique_lock<std::mutex> lock(WakeLock);
+  if (std::chrono::steady_clock::time_point::max() == deadline)
   {
-    TransitionToScan = true;
+    WakeEvent.wait(lock, [this]() { return WakePending; });
   }
+  else
+  {
+    WakeEvent.wait_until(lock, deadline, [this]() { return WakePending; });
+  }
+
+  WakePending = false;
 }
 
-std::vector<LightHouse*> LHV2Mgr::GetLighthouses()
+void LHV2Mgr::MarkCommand()
 {
-  return Lighthouses;
+  CommandTick = std::chrono::steady_clock::now().time_since_epoch().count();
 }
 
-void LHV2Mgr::PowerOnDevices()
+bool LHV2Mgr::PublishDevices()
 {
-  if (PROCESSING == DiscState)
+  std::shared_ptr<std::vector<DeviceSnapshot>> devices = 
+    std::make_shared<std::vector<DeviceSnapshot>>(Stations.Size());
+
+  size_t subscribed = 0;
+  size_t unreachable = 0;
+
+  for (size_t i = 0; i < Stations.Size(); ++i)
+  {
+    DeviceSnapshot& device = (*devices)[i];
+    device.Address = Stations.At(i)->GetAddress();
+    device.Identifier = Stations.At(i)->GetIdentifier();
+    device.Status = Stations.At(i)->GetStatus();
+    device.Subscribed = Stations.At(i)->IsSubscribed();
+    subscribed += (true == device.Subscribed) ? 1 : 0;
+    device.Link = Stations.At(i)->GetConnectionStats();
+    device.Health = Stations.At(i)->GetHealth();
+    device.PowerState = Stations.At(i)->GetPowerState();
+    device.Wake = Stations.At(i)->GetLastWake();
+    device.Adapter = Stations.At(i)->GetAdapter();
+    device.Rssi = Stations.At(i)->GetRssi();
+    unreachable += (LightHouse::UNREACHABLE == device.Health.State) ? 1 : 0;
+    device.LastSeen = Stations.At(i)->GetLastSeen();
+  }
+
+  DeviceList previous = std::atomic_load(&PublishedDevices);
+  std::atomic_store(&PublishedDevices, DeviceList(devices));
+
+  Metrics::Set(Metrics::STATIONS, static_cast<int64_t>(devices->size()));
+  Metrics::Set(Metrics::SUBSCRIBED_STATIONS, static_cast<int64_t>(subscribed));
+  Metrics::Set(Metrics::UNREACHABLE_STATIONS, static_cast<int64_t>(unreachable));
+
+  // Only tell the GUI about the rows that moved, most passes change nothing
+  PublishedChanges.Changed.clear();
+  PublishedChanges.Reset = (previous->size() != devices->size());
+  for (size_t i = 0; (false == PublishedChanges.Reset) && (i < devices->size()); ++i)
+  {
+    if ((*previous)[i].Address != (*devices)[i].Address)
+    {
+      PublishedChanges.Reset = true;
+    }
+    else if (false == IsSameState((*previous)[i], (*devices)[i]))
+    {
+      PublishedChanges.Changed.push_back(i);
+    }
+  }
+
+  if ((false == PublishedChanges.Reset) && (true == PublishedChanges.Changed.empty()))
   {
-    DiscState = POWERING_ON;
+    return false;
   }
+
+  PublishedChanges.Devices = devices;
+  Alert(DEVICES_CHANGED, &PublishedChanges);
+  PublishedChanges.Devices.reset();
+  return true;
 }
 
-void LHV2Mgr::PowerOffDevices()
+CommandQueue::PushResult LHV2Mgr::SubmitCommand(CommandQueue::CommandEnum command)
 {
-  if (PROCESSING == DiscState)
+  // Without a scan loop nothing would ever run or complete the command
+  if (nullptr != FailureReason)
   {
-    DiscState = TERMINATING;
+    Metrics::Increment(Metrics::COMMANDS_REJECTED);
+    RejectCommand(command, FailureReason);
+    return CommandQueue::REJECTED;
   }
+
+  CommandQueue::PushResult res = Commands.Push(command);
+  switch (res)
+  {
+  case CommandQueue::QUEUED:
+    Metrics::Increment(Metrics::COMMANDS_QUEUED);
+    if (CommandQueue::REFRESH != command)
+    {
+      MarkCommand();
+    }
+    Wake();
+    break;
+  case CommandQueue::COLLAPSED:
+    Metrics::Increment(Metrics::COMMANDS_COLLAPSED);
+    break;
+  case CommandQueue::REJECTED:
+    Metrics::Increment(Metrics::COMMANDS_REJECTED);
+    RejectCommand(command, "Too many pending commands");
+    break;
+  default:
+    break;
+  }
+
+  return res;
+}
+
+// Adapters can only go away with the manager, this just guards the index
+size_t LHV2Mgr::AdapterOf(LightHouse* lighthouse) const
+{
+  return std::min(lighthouse->GetAdapter(), Adapters.size() - 1);
+}
+
+bool LHV2Mgr::IsProbing(LightHouse* lighthouse) const
+{
+  std::map<LightHouse*, std::future<void>>::const_iterator itr = Probes.find(lighthouse);
+  return (Probes.end() != itr) &&
+         (std::future_status::ready != itr->second.wait_for(std::chrono::seconds(0)));
+}
+
+// Gives each unreachable station whose backoff has run out one attempt on a
+// worker. The scan loop leaves it alone until the attempt finishes.
+void LHV2Mgr::ProbeUnreachable()
+{
+  for (size_t i = 0; i < Stations.Size(); ++i)
+  {
+    LightHouse* lighthouse = Stations.At(i);
+    if ((LightHouse::UNREACHABLE != lighthouse->GetHealth().State) ||
+        (false == lighthouse->IsProbeDue()) ||
+        (true == IsProbing(lighthouse)))
+    {
+      continue;
+    }
+
+    Metrics::Increment(Metrics::PROBES);
+    Probes[lighthouse] = AsyncMgr::Instance()->Spawn([this, lighthouse](const CancelToken&)
+    {
+      if (true == lighthouse->PollPowerState())
+      {
+        lighthouse->SubscribePowerState();
+      }
+
+      // Republish either way so the next probe time shows up
+      Wake();
+    }, Token);
+  }
+}
+
+void LHV2Mgr::SetState(DiscoveryStateEnum state)
+{
+  static const Metrics::CounterEnum TRANSITIONS[] =
+  {
+    Metrics::TRANSITIONS_IDLE,
+    Metrics::TRANSITIONS_SCAN,
+    Metrics::COUNTER_COUNT, // VALIDATE is never entered
+    Metrics::TRANSITIONS_PROCESSING,
+    Metrics::TRANSITIONS_TERMINATING,
+    Metrics::TRANSITIONS_POWERING_ON
+  };
+
+  if ((state != DiscState) && (Metrics::COUNTER_COUNT != TRANSITIONS[state]))
+  {
+    Metrics::Increment(TRANSITIONS[state]);
+  }
+
+  DiscState = state;
+}
+
+bool LHV2Mgr::StartCommand(CommandQueue::CommandEnum command)
+{
+  switch (command)
+  {
+  case CommandQueue::REFRESH:
+    SetState(SCAN);
+    return true;
+  case CommandQueue::POWER_ON:
+  case CommandQueue::POWER_OFF:
+    if (IDLE == DiscState)
+    {
+      RejectCommand(command, "No Base Stations found");
+      return false;
+    }
+
+    SetState((CommandQueue::POWER_ON == command) ? POWERING_ON : TERMINATING);
+    return true;
+  default:
+    RejectCommand(command, "Unknown command");
+    return false;
+  }
+}
+
+void LHV2Mgr::RejectCommand(CommandQueue::CommandEnum command, const char* reason)
+{
+  Commands.Complete(command);
+
+  CommandRejection rejection;
+  rejection.Command = command;
+  rejection.Reason = reason;
+  Alert(COMMAND_REJECTED, &rejection);
 }
 
 
 void LHV2Mgr::DeviceScanLoop(LHV2Mgr* instance)
 {
   uint32_t shutoff_tick = 0;
+  bool commandActive = false;
+  CommandQueue::CommandEnum activeCommand = CommandQueue::REFRESH;
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point nextPoll = deadline;
+
+  // Current poll interval, doubles while the fleet is stable
+  std::chrono::milliseconds backoff(instance->PollIntervalMs);
+
+  // Set from a pre-wake until the session it anticipated starts
+  bool preWaking = false;
+  std::chrono::steady_clock::time_point preWakeStart;
+  std::chrono::steady_clock::time_point preWakeReady;
 
   assert(nullptr != instance);
 
-  for (;; std::this_thread::sleep_for(std::chrono::milliseconds(1000)))
+  // Commands wake the loop immediately, otherwise it sleeps until the
+  // deadline set by the current state.
+  for (; false == instance->Token.IsCancelled(); instance->WaitForWork(deadline))
   {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    const std::chrono::milliseconds pollInterval(instance->PollIntervalMs);
+    const std::chrono::milliseconds maxPollInterval(
+      std::max(instance->PollIntervalMs.load(), instance->MaxPollIntervalMs.load()));
+
+    // A VR session starting or ending is worth a look straight away
+    bool polled = false;
+    bool settled = true;
+    if (true == instance->FastPollPending.exchange(false))
+    {
+      settled = false;
+      nextPoll = now;
+    }
+
+    // Close connections that haven't been used within the idle timeout
+    std::chrono::milliseconds idleTimeout(instance->IdleTimeoutMs);
+    for (size_t i = 0; i < instance->Stations.Size(); ++i)
+    {
+      if (false == instance->IsProbing(instance->Stations.At(i)))
+      {
+        instance->Stations.At(i)->CloseIfIdle(idleTimeout);
+      }
+    }
+
+    // State changes run the next state straight away
+    deadline = now;
+
+    // Commands are only taken in the resting states. Anything that arrives
+    // during a scan or power cycle waits in the queue until it's finished,
+    // and repeats of the running command collapse into it until then.
+    bool commandTaken = false;
+    if ((IDLE == instance->DiscState) || (PROCESSING == instance->DiscState))
+    {
+      if (true == commandActive)
+      {
+        instance->Commands.Complete(activeCommand);
+        commandActive = false;
+      }
+
+      commandTaken = instance->Commands.Pop(activeCommand);
+      if (true == commandTaken)
+      {
+        commandActive = instance->StartCommand(activeCommand);
+      }
+    }
+
     switch (instance->DiscState)
     {
       case IDLE:
       {
-        // Do nothing...
+        // Nothing to do until a command arrives, other than closing idle links
+        deadline = (true == instance->Stations.Empty()) ? 
+                   std::chrono::steady_clock::time_point::max() : 
+                   now + idleTimeout;
       }
       break;
       case SCAN:
       {
-        instance->_AlertCallback(SCANNING, nullptr);
-        instance->Adapters[instance->ActiveAdapter].scan_for(10000);
-        instance->Peripherals = instance->Adapters[instance->ActiveAdapter].scan_get_results();
+        instance->Alert(SCANNING, nullptr);
+        DiscoveryReport report = instance->DiscoverDevices();
+        Metrics::Observe(Metrics::DISCOVERY_DURATION, report.Elapsed);
 
-        // Scan for matching lighthouse adapter name
-        for (size_t i = 0; i < instance->Peripherals.size(); ++i)
+        // Completed before the report goes out, so a repeat sent in
+        // response to it is queued again rather than collapsed into it
+        if (true == commandActive)
         {
-          if (std::string::npos !=
-              instance->Peripherals[i].identifier().find(LightHouse::LIGHTHOUSE_ID))
-          {
-            LightHouse* lighthouse = new LightHouse(instance->Peripherals[i].address(),
-                                                    instance->Peripherals[i].identifier(),
-                                                    &(instance->Peripherals[i]));
-            instance->Lighthouses.push_back(lighthouse);
-          }
+          instance->Commands.Complete(activeCommand);
+          commandActive = false;
         }
 
-        // Extract valid lighthouses from the above results
-        bool valid = false;
-        for (size_t i = 0; i < instance->Lighthouses.size(); ++i)
-        {
-          instance->Lighthouses[i]->ReadCharacteristics();
-          if (true == instance->Lighthouses[i]->IsValidLighthouse())
-          {
-            valid = true;
-            break;
-          }
-        }
+        instance->Alert(DISCOVERY_COMPLETE, &report);
 
-        if (false == valid)
+        if (true == instance->Stations.Empty())
         {
-          instance->Lighthouses.clear();
-          instance->DiscState = IDLE;
+          instance->SetState(IDLE);
         }
         else
         {
-          instance->DiscState = PROCESSING;
+          instance->SaveCache();
+          instance->SetState(PROCESSING);
+          backoff = pollInterval;
+          nextPoll = std::chrono::steady_clock::now() + backoff;
+
+          // Stations taken from the cache haven't been read yet
+          if (true == report.Warm)
+          {
+            nextPoll = std::chrono::steady_clock::now();
+          }
         }
 
-        instance->_AlertCallback(READY, nullptr);
+        instance->Alert(READY, nullptr);
       }
       break;
       case PROCESSING:
       {
+        // A session is on its way, power on now unless something already did.
+        // A start seen in any other state waits here, the stations may still
+        // be being discovered.
+        if ((true == instance->PreWakePending.exchange(false)) &&
+            (true == instance->SessionStarting) &&
+            (false == instance->VRDetector->IsActive()))
+        {
+          bool asleep = false;
+          for (size_t i = 0; i < instance->Stations.Size(); ++i)
+          {
+            asleep = asleep || (false == instance->Stations.At(i)->IsPowered());
+          }
+
+          if (true == asleep)
+          {
+            instance->MarkCommand();
+            Metrics::Increment(Metrics::PRE_WAKES);
+            instance->SetState(POWERING_ON);
+            preWaking = true;
+            preWakeStart = now;
+            preWakeReady = std::chrono::steady_clock::time_point();
+            deadline = now;
+            break;
+          }
+        }
+
+        // Woken early by a command that didn't need a poll
+        if (now < nextPoll)
+        {
+          deadline = nextPoll;
+          break;
+        }
+
+        polled = true;
+        nextPoll = now + backoff;
+        deadline = nextPoll;
+
         // Do not continue if SteamVR is active
-        if (true == IsValveVRActive())
+        if (true == instance->VRDetector->IsActive())
         {
+          if (true == preWaking)
+          {
+            std::chrono::steady_clock::time_point session{ std::chrono::steady_clock::duration(instance->SessionTick) };
+
+            PreWakeReport report;
+            report.Ready = (std::chrono::steady_clock::time_point() != preWakeReady);
+            report.Lead = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::max(session, preWakeStart) - preWakeStart);
+            report.Saved = (true == report.Ready) ?
+                           std::chrono::duration_cast<std::chrono::milliseconds>(preWakeReady - preWakeStart) :
+                           report.Lead;
+            Metrics::Observe(Metrics::PRE_WAKE_SAVED, report.Saved);
+            instance->Alert(PRE_WAKE_COMPLETE, &report);
+            preWaking = false;
+          }
+
           shutoff_tick = 0;
-          instance->_AlertCallback(VR_ACTIVE, nullptr);
+          Metrics::Increment(Metrics::POLL_TICKS_VR_SKIPPED);
+          instance->Alert(VR_ACTIVE, nullptr);
           break;
         }
 
-        // Increment shutoff tick if any of the lighthouses are active
-        for (size_t i = 0; i < instance->Lighthouses.size(); ++i)
+        bool booting = false;
+        PollReport poll;
+        poll.Polled = 0;
+        poll.Active = 0;
+        poll.Unreachable = 0;
+        for (size_t i = 0; i < instance->Stations.Size(); ++i)
         {
-          if (true == instance->Lighthouses[i]->ReadCharacteristics())
+          // Unreachable stations are probed off the loop, so a dead one
+          // doesn't hold up the rest with connect timeouts
+          LightHouse* lighthouse = instance->Stations.At(i);
+          if ((true == instance->IsProbing(lighthouse)) ||
+              (LightHouse::UNREACHABLE == lighthouse->GetHealth().State))
           {
-            std::string status = instance->Lighthouses[i]->GetStatus();
-            if (std::string::npos != status.find("ON"))
-            {
-              ++shutoff_tick;
-            }
+            ++poll.Unreachable;
+            continue;
+          }
+
+          // Subscribed devices push their state, the rest are polled and
+          // retry the subscription (a no-op once it's known unsupported)
+          bool current = lighthouse->IsSubscribed();
+          if (false == current)
+          {
+            ++poll.Polled;
+            current = lighthouse->PollPowerState();
+            lighthouse->SubscribePowerState();
+          }
+
+          LightHouse::PowerStateEnum state = lighthouse->GetPowerState();
+          if ((true == current) && (LightHouse::POWER_ON == state))
+          {
+            ++poll.Active;
+          }
+
+          if ((LightHouse::POWER_WAKING == state) || (LightHouse::POWER_BOOTING == state))
+          {
+            booting = true;
+            settled = false;
           }
         }
 
-        // Transition to termination if we exceed the shutoff limit
-        if (instance->Lighthouses.size() < shutoff_tick)
+        // One shutoff tick per pass with a station tracking. The countdown
+        // waits for every station to finish booting, so it can't cut short
+        // the ones that wake last.
+        shutoff_tick = ((0 < poll.Active) && (false == booting)) ? shutoff_tick + 1 : 0;
+
+        instance->ProbeUnreachable();
+
+        // Every station a pre-wake woke is tracking, the session isn't up yet
+        if ((true == preWaking) &&
+            (std::chrono::steady_clock::time_point() == preWakeReady) &&
+            (instance->Stations.Size() - poll.Unreachable == poll.Active))
+        {
+          preWakeReady = std::chrono::steady_clock::now();
+        }
+
+        // SteamVR can take a while to get from its launcher to vrmonitor,
+        // don't power off what was woken for it in the meantime. vrserver
+        // can also outlive vrmonitor or run without it, so only for so long.
+        std::chrono::steady_clock::time_point starting{ std::chrono::steady_clock::duration(instance->StartingTick) };
+        if ((true == instance->SessionStarting) &&
+            (now < starting + std::chrono::milliseconds(PRE_WAKE_HOLD_MS)))
         {
-          instance->DiscState = TERMINATING;
           shutoff_tick = 0;
-          break;
         }
 
-        // User manually prompted a re-scan. We transition here
-        // to avoid multiple threads attempting to execute BLE functions.
-        if (true == instance->TransitionToScan)
+        poll.Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - now);
+        Metrics::Increment(Metrics::POLL_TICKS);
+        Metrics::Observe(Metrics::POLL_DURATION, poll.Elapsed);
+        instance->Alert(POLL_COMPLETE, &poll);
+
+        // Transition to termination if we exceed the shutoff limit
+        if (AUTO_SHUTOFF_POLLS <= shutoff_tick)
         {
-          instance->TransitionToScan = false;
-          instance->DiscState = SCAN;
+          instance->MarkCommand();
+          Metrics::Increment(Metrics::AUTO_SHUTOFFS);
+          instance->SetState(TERMINATING);
+          deadline = now;
+          shutoff_tick = 0;
           break;
         }
 
-        instance->_AlertCallback(READY, nullptr);
+        instance->Alert(READY, nullptr);
       }
       break;
       case TERMINATING:
       {
-        instance->_AlertCallback(TERMINATE, nullptr);
-        for (size_t i = 0; i < instance->Lighthouses.size(); ++i)
+        // A pre-wake that no session followed is over
+        preWaking = false;
+        instance->Alert(TERMINATE, nullptr);
+        PowerReport report = instance->DispatchPower(false);
+        Metrics::Observe(Metrics::POWER_OFF_DURATION, report.Elapsed);
+
+        // As for SCAN, the report is the last thing the caller waits on
+        if (true == commandActive)
         {
-          instance->Lighthouses[i]->PowerOff();
+          instance->Commands.Complete(activeCommand);
+          commandActive = false;
         }
 
-        instance->DiscState = PROCESSING;
+        instance->Alert(POWER_COMPLETE, &report);
+
+        instance->SetState(PROCESSING);
+        backoff = pollInterval;
+        nextPoll = std::chrono::steady_clock::now() + backoff;
+        deadline = nextPoll;
       }
       break;
       case POWERING_ON:
       {
-        instance->_AlertCallback(POWER_ON, nullptr);
-        for (size_t i = 0; i < instance->Lighthouses.size(); ++i)
+        // The shutoff countdown starts over, so it can't cut the boot short
+        instance->Alert(POWER_ON, nullptr);
+        shutoff_tick = 0;
+        PowerReport report = instance->DispatchPower(true);
+        Metrics::Observe(Metrics::POWER_ON_DURATION, report.Elapsed);
+
+        // As for SCAN, the report is the last thing the caller waits on
+        if (true == commandActive)
         {
-          instance->Lighthouses[i]->PowerOn();
+          instance->Commands.Complete(activeCommand);
+          commandActive = false;
         }
 
-        instance->DiscState = PROCESSING;
+        instance->Alert(POWER_COMPLETE, &report);
+
+        instance->SetState(PROCESSING);
+        backoff = pollInterval;
+        nextPoll = std::chrono::steady_clock::now() + backoff;
+        deadline = nextPoll;
       }
       break;
       default:
       assert(false);
       break;
     }
+
+    // Look for further queued commands straight away
+    if (true == commandTaken)
+    {
+      deadline = now;
+    }
+
+    // Poll again soon after anything moves, back off while nothing does.
+    // A shutoff countdown also runs at the base interval, or stations left
+    // on beside sleeping ones would take ever longer to be powered off.
+    if ((true == instance->PublishDevices()) || (false == settled) || (0 < shutoff_tick))
+    {
+      backoff = pollInterval;
+      nextPoll = std::min(nextPoll, now + backoff);
+    }
+    else if (true == polled)
+    {
+      backoff = std::min(backoff * 2, maxPollInterval);
+      nextPoll = now + backoff;
+    }
+
+    // Links opened by the poll still close on time in between
+    if ((PROCESSING == instance->DiscState) && (true == polled))
+    {
+      deadline = std::min(nextPoll, std::chrono::steady_clock::now() + idleTimeout);
+    }
+    else if (PROCESSING == instance->DiscState)
+    {
+      deadline = std::min(deadline, nextPoll);
+    }
+  }
+
+  // Probes hold on to their stations, let them finish before those go away
+  for (std::map<LightHouse*, std::future<void>>::iterator itr = instance->Probes.begin();
+       itr != instance->Probes.end();
+       ++itr)
+  {
+    itr->second.wait();
   }
 }
 
-bool LHV2Mgr::IsValveVRActive()
+void LHV2Mgr::LighthouseStatusCallback(LightHouse* /* lighthouse */, void* pContext)
 {
-  bool active = false;
+  // Runs on the BLE stack's thread, leave publishing to the scan loop
+  LHV2Mgr* instance = reinterpret_cast<LHV2Mgr*>(pContext);
+  instance->Wake();
+}
 
-  HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-  if (INVALID_HANDLE_VALUE != hSnap)
+void LHV2Mgr::VRSessionCallback(bool active, void* pContext)
+{
+  // Let the loop react to the session starting/ending straight away
+  LHV2Mgr* instance = reinterpret_cast<LHV2Mgr*>(pContext);
+  if (true == active)
   {
-    PROCESSENTRY32 pe32;
-    pe32.dwSize = sizeof(PROCESSENTRY32);
-    if (Process32First(hSnap, &pe32))
-    {
-      do
-      {
-        char wtoC[256] = { 0 };
-        for (size_t i = 0; i < lstrlen(pe32.szExeFile); ++i)
-        {
-          wtoC[i] = pe32.szExeFile[i] & 0xFF;
-        }
+    instance->SessionTick = std::chrono::steady_clock::now().time_since_epoch().count();
+  }
 
-        if (std::string::npos != std::string(wtoC).find("vrmonitor.exe"))
-        {
-          active = true;
-          break;
-        }
-      } while (Process32Next(hSnap, &pe32));
-    }
+  instance->FastPollPending = true;
+  instance->Wake();
+}
 
-    CloseHandle(hSnap);
+void LHV2Mgr::StartupSessionCallback(bool active, void* pContext)
+{
+  // Runs on the detector's thread, the loop decides whether to act on it
+  LHV2Mgr* instance = reinterpret_cast<LHV2Mgr*>(pContext);
+  if (true == active)
+  {
+    instance->StartingTick = std::chrono::steady_clock::now().time_since_epoch().count();
+    instance->PreWakePending = true;
   }
 
-  return active;
+  instance->SessionStarting = active;
+
+  instance->Wake();
 }
 
-LHV2Mgr::LHV2Mgr(AlertCallback cb) :
+LHV2Mgr::LHV2Mgr(AlertCallback cb, std::shared_ptr<BLEBackend> backend, const std::string& cachePath) :
   DiscState(IDLE),
-  ActiveAdapter(0),
   _AlertCallback(cb),
-  TransitionToScan(false)
+  FailureReason(nullptr),
+  MaxConnections(DEFAULT_MAX_CONNECTIONS),
+  IdleTimeoutMs(DEFAULT_IDLE_TIMEOUT_MS),
+  ExpectedStations(0),
+  ScanQuietMs(DEFAULT_SCAN_QUIET_MS),
+  AdapterMergeMs(DEFAULT_ADAPTER_MERGE_MS),
+  PollIntervalMs(DEFAULT_POLL_INTERVAL_MS),
+  MaxPollIntervalMs(DEFAULT_MAX_POLL_INTERVAL_MS),
+  UseStandby(false),
+  Backend(backend),
+  CachePath(cachePath),
+  VRDetector(nullptr),
+  StartupDetector(nullptr),
+  SessionStarting(false),
+  StartingTick(0),
+  PreWakePending(false),
+  SessionTick(0),
+  PublishedDevices(std::make_shared<std::vector<DeviceSnapshot>>()),
+  FastPollPending(false),
+  WakePending(false),
+  CommandTick(0)
 {
   assert(nullptr != _AlertCallback);
 
-  if (false == SimpleBLE::Adapter::bluetooth_enabled())
+  if ((nullptr == Backend) || (false == Backend->IsBluetoothEnabled()))
   {
-    _AlertCallback(BT_NOT_ENABLED, nullptr);
+    FailureReason = "Bluetooth not enabled";
+    Alert(BT_NOT_ENABLED, nullptr);
     return;
   }
 
-  Adapters = SimpleBLE::Adapter::get_adapters();
+  Adapters = Backend->GetAdapters();
   if (0 == Adapters.size())
   {
-    _AlertCallback(NO_ADAPTERS_FOUND, nullptr);
+    FailureReason = "No Bluetooth adapter";
+    Alert(NO_ADAPTERS_FOUND, nullptr);
     return;
   }
 
-  AsyncMgr::Instance()->Spawn(DeviceScanLoop, this);
+  LoadCache();
+  ReserveWorkers();
+
+  VRDetector = VRSessionDetector::Create(VRSessionDetector::VR_PROCESS_NAME, VRSessionCallback, this);
+
+  Token = AsyncMgr::Instance()->GetToken().Child();
+  ScanTask = AsyncMgr::Instance()->Spawn([this](const CancelToken&)
+  {
+    DeviceScanLoop(this);
+  }, Token);
 }
 
-LHV2Mgr::~LHV2Mgr()
+// Stops the detectors and the scan loop. Returns false, with alerts already
+// cut off, if the loop didn't finish within SHUTDOWN_TIMEOUT_MS.
+bool LHV2Mgr::Stop()
+{
+  // Nothing calls back into the manager once these are joined, the loop
+  // can still read their state
+  if (nullptr != VRDetector)
+  {
+    VRDetector->Stop();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(StartupLock);
+    if (nullptr != StartupDetector)
+    {
+      StartupDetector->Stop();
+    }
+  }
+
+  Token.Cancel();
+  Wake();
+
+  // BLE calls in flight can't be interrupted, so the scan loop gets a bounded
+  // amount of time to notice the cancellation
+  if ((true == ScanTask.valid()) &&
+      (std::future_status::timeout == ScanTask.wait_for(std::chrono::milliseconds(SHUTDOWN_TIMEOUT_MS))))
+  {
+    TRACE_ERROR(SCAN_LOOP_STALLED, 0, SHUTDOWN_TIMEOUT_MS);
+
+    // Waits out an alert in flight, any later one sees the cancellation
+    std::lock_guard<std::recursive_mutex> lock(AlertLock);
+    return false;
+  }
+
+  return true;
+}
+
+void LHV2Mgr::Alert(AlertEnum alert, void* pDetails)
 {
+  std::lock_guard<std::recursive_mutex> lock(AlertLock);
+  if (false == Token.IsCancelled())
+  {
+    _AlertCallback(alert, pDetails);
+  }
+}
 
-}
\ No newline at end of file
+// Only reached once the scan loop has finished
+LHV2Mgr::~LHV2Mgr()
+{
+  Stations.Clear();
+  VRSessionDetector::Destroy(VRDetector);
+  VRSessionDetector::Destroy(StartupDetector);
+}
@@ -1,7 +1,18 @@
 #pragma once
+#include "AsyncMgr.h"
+#include "BLEBackend.h"
+#include "CommandQueue.h"
 #include "LightHouse.h"
-#include <simpleble/Adapter.h>
-#include <simpleble/Peripheral.h>
+#include "StationRegistry.h"
+#include "VRSessionDetector.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 class LHV2Mgr
@@ -15,28 +26,186 @@ public:
     NO_ADAPTERS_FOUND,
     SCANNING,
     READY,
-    STATUS,
+    DEVICES_CHANGED,
     VR_ACTIVE,
     POWER_ON,
-    TERMINATE
+    TERMINATE,
+    POWER_COMPLETE,
+    DISCOVERY_COMPLETE,
+    COMMAND_REJECTED,
+    POLL_COMPLETE,
+    PRE_WAKE_COMPLETE
   };
   typedef void(*AlertCallback)(const AlertEnum alert, void* pDetails);
 
-  static LHV2Mgr* Create(AlertCallback cb);
+  // Outcome of a power on/off fan-out, passed with POWER_COMPLETE
+  struct PowerResult
+  {
+    std::string Address;
+    bool Success;
+    std::chrono::milliseconds Elapsed;
+    LightHouse::PowerTimings Phases;
+  };
+
+  // CommandLatency is the time from the command (or the automatic shutoff)
+  // to the first power write reaching a device. Standby is set when a power
+  // off put the stations in standby rather than to sleep.
+  struct PowerReport
+  {
+    bool PowerOn;
+    bool Standby;
+    std::vector<PowerResult> Results;
+    std::chrono::milliseconds Elapsed;
+    std::chrono::milliseconds CommandLatency;
+  };
+
+  // Immutable copy of a station's state. The scan loop publishes a new list
+  // after every pass, readers hold on to theirs for as long as they like.
+  struct DeviceSnapshot
+  {
+    std::string Address;
+    std::string Identifier;
+    std::string Status;
+    bool Subscribed;
+    LightHouse::ConnectionStats Link;
+    LightHouse::HealthStats Health;
+    LightHouse::PowerStateEnum PowerState;
+    LightHouse::WakeStats Wake;
+    size_t Adapter;
+    int16_t Rssi;
+    std::chrono::steady_clock::time_point LastSeen;
+  };
+  typedef std::shared_ptr<const std::vector<DeviceSnapshot>> DeviceList;
+
+  // Passed with DEVICES_CHANGED when a newly published list differs from
+  // the last one. Changed holds the rows whose state moved, Reset is set
+  // when stations came, went or were reordered and every row is suspect.
+  // Link counters, RSSI and LastSeen move on every poll and don't count.
+  struct DeviceChanges
+  {
+    DeviceList Devices;
+    std::vector<size_t> Changed;
+    bool Reset;
+  };
+
+  // Passed with COMMAND_REJECTED
+  struct CommandRejection
+  {
+    CommandQueue::CommandEnum Command;
+    const char* Reason;
+  };
+
+  // Outcome of a discovery pass, passed with DISCOVERY_COMPLETE. Warm
+  // discoveries started out with stations from the on-disk cache. Dropped
+  // counts unreachable stations that didn't answer and were forgotten.
+  struct DiscoveryReport
+  {
+    bool Warm;
+    size_t Cached;
+    size_t Found;
+    size_t Dropped;
+    std::chrono::milliseconds Elapsed;
+  };
+
+  // Outcome of one steady-state poll pass, passed with POLL_COMPLETE.
+  // Polled counts the stations that had to be read rather than pushing
+  // their state, Unreachable the ones left to their own probe schedule.
+  struct PollReport
+  {
+    size_t Polled;
+    size_t Active;
+    size_t Unreachable;
+    std::chrono::microseconds Elapsed;
+  };
+
+  // Passed with PRE_WAKE_COMPLETE when the session a pre-wake anticipated
+  // starts. Lead is how far ahead of vrmonitor the stations were woken.
+  // Saved is how much sooner they were tracking than a power on at that
+  // point would have managed: all of Lead while they were still booting,
+  // the whole wake when they were Ready first.
+  struct PreWakeReport
+  {
+    bool Ready;
+    std::chrono::milliseconds Lead;
+    std::chrono::milliseconds Saved;
+  };
+
+  static const size_t   DEFAULT_MAX_CONNECTIONS = 4;
+  static const uint32_t DEFAULT_IDLE_TIMEOUT_MS = 10000;
+  static const uint32_t DEFAULT_POLL_INTERVAL_MS = 1000;
+  static const uint32_t DEFAULT_MAX_POLL_INTERVAL_MS = 30000;
+  static const uint32_t SCAN_TIMEOUT_MS = 10000;
+  static const uint32_t DEFAULT_SCAN_QUIET_MS = 3000;
+  static const uint32_t DEFAULT_ADAPTER_MERGE_MS = 500;
+  static const uint32_t SHUTDOWN_TIMEOUT_MS = 2000;
+  static const uint32_t CANCEL_CHECK_MS = 250;
+  static const size_t   RESERVED_WORKERS = 4;
+  static const uint32_t PRE_WAKE_HOLD_MS = 120000;
+  static const uint32_t AUTO_SHUTOFF_POLLS = 2;
+
+  // The station cache goes to cachePath, GetCachePath() by default
+  static LHV2Mgr* Create(AlertCallback cb,
+                         std::shared_ptr<BLEBackend> backend,
+                         const std::string& cachePath = GetCachePath());
   static void Destroy(LHV2Mgr* instance);
-  void RefreshDevices();
-  std::vector<LightHouse*> GetLighthouses();
-  void PowerOnDevices();
-  void PowerOffDevices();
+  CommandQueue::PushResult RefreshDevices();
+  DeviceList GetDevices() const;
+  CommandQueue::PushResult PowerOnDevices();
+  CommandQueue::PushResult PowerOffDevices();
+  void SetMaxConnections(size_t limit);
+  void SetIdleTimeout(std::chrono::milliseconds timeout);
+  void SetExpectedStations(size_t count);
+  void SetScanQuietPeriod(std::chrono::milliseconds period);
+  void SetAdapterMergeWindow(std::chrono::milliseconds window);
+  void SetPollInterval(std::chrono::milliseconds interval);
+  void SetMaxPollInterval(std::chrono::milliseconds interval);
+  void SetStandbyPolicy(bool standby);
+  void SetPreWake(bool enable);
+  static std::string GetCachePath();
 
 private:
 
   static void DeviceScanLoop(LHV2Mgr* instance);
-  static bool IsValveVRActive();
+  static void VRSessionCallback(bool active, void* pContext);
+  static void StartupSessionCallback(bool active, void* pContext);
+  static void LighthouseStatusCallback(LightHouse* lighthouse, void* pContext);
+  PowerReport DispatchPower(bool powerOn);
+  DiscoveryReport DiscoverDevices();
+  void LoadCache();
+  void SaveCache();
+  void Wake();
+  void WaitForWork(std::chrono::steady_clock::time_point deadline);
+  void MarkCommand();
+  bool PublishDevices();
+  CommandQueue::PushResult SubmitCommand(CommandQueue::CommandEnum command);
+  bool StartCommand(CommandQueue::CommandEnum command);
+  void RejectCommand(CommandQueue::CommandEnum command, const char* reason);
+  void ReserveWorkers();
+  size_t AdapterOf(LightHouse* lighthouse) const;
+  bool IsProbing(LightHouse* lighthouse) const;
+  void ProbeUnreachable();
 
-  LHV2Mgr(AlertCallback cb);
+  LHV2Mgr(AlertCallback cb, std::shared_ptr<BLEBackend> backend, const std::string& cachePath);
   ~LHV2Mgr();
 
+  // Station remembered from a previous run, with its GATT layout so that
+  // service discovery can be skipped
+  struct KnownStation
+  {
+    std::string Address;
+    std::string Identifier;
+    std::vector<std::pair<Uuid128, Uuid128>> Characteristics;
+  };
+
+  // A station heard during discovery, by the adapter with the best RSSI so far
+  struct Candidate
+  {
+    std::shared_ptr<BLEPeripheral> Peripheral;
+    size_t Adapter;
+    int16_t Rssi;
+    std::chrono::steady_clock::time_point Ready;
+  };
+
   enum DiscoveryStateEnum
   {
     IDLE,
@@ -47,13 +216,51 @@ private:
     POWERING_ON
   };
 
+  void SetState(DiscoveryStateEnum state);
+  void Alert(AlertEnum alert, void* pDetails);
+  bool Stop();
+
   DiscoveryStateEnum DiscState;
   AlertCallback _AlertCallback;
 
-  size_t ActiveAdapter;
-  std::vector<SimpleBLE::Adapter> Adapters;
-  std::vector<SimpleBLE::Peripheral> Peripherals;
-  std::vector<LightHouse*> Lighthouses;
-  bool TransitionToScan;
+  // Set when the manager couldn't start, every command is rejected with it
+  const char* FailureReason;
+
+  // Held while an alert is delivered. Recursive, a callback may submit a
+  // command that is rejected straight away.
+  std::recursive_mutex AlertLock;
+
+  std::atomic<size_t> MaxConnections;
+  std::atomic<uint32_t> IdleTimeoutMs;
+  std::atomic<size_t> ExpectedStations;
+  std::atomic<uint32_t> ScanQuietMs;
+  std::atomic<uint32_t> AdapterMergeMs;
+  std::atomic<uint32_t> PollIntervalMs;
+  std::atomic<uint32_t> MaxPollIntervalMs;
+  std::atomic<bool> UseStandby;
+  std::shared_ptr<BLEBackend> Backend;
+  std::vector<std::shared_ptr<BLEAdapter>> Adapters;
+  StationRegistry Stations;
+  std::map<LightHouse*, std::future<void>> Probes;
+  std::string CachePath;
+  std::unordered_map<std::string, KnownStation> KnownStations;
+  VRSessionDetector* VRDetector;
+  VRSessionDetector* StartupDetector;
+  std::mutex StartupLock;
+  std::atomic<bool> SessionStarting;
+  std::atomic<std::chrono::steady_clock::rep> StartingTick;
+  std::atomic<bool> PreWakePending;
+  std::atomic<std::chrono::steady_clock::rep> SessionTick;
+  CancelToken Token;
+  std::future<void> ScanTask;
+  CommandQueue Commands;
+  DeviceList PublishedDevices;
+  DeviceChanges PublishedChanges;
+  std::atomic<bool> FastPollPending;
+
+  std::mutex WakeLock;
+  std::condition_variable WakeEvent;
+  bool WakePending;
+  std::atomic<std::chrono::steady_clock::rep> CommandTick;
 };
 
@@ -1,22 +1,78 @@
 #include "LightHouse.h"
-#include <simpleble/SimpleBLE.h>
-#include <Windows.h>
+#include "Metrics.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 const char* LightHouse::LIGHTHOUSE_ID = "LHB-";
-const char* LightHouse::PWR_SVC_UUID  = "00001523-1212-efde-1523-785feabcd124";
-const char* LightHouse::PWR_CHAR_UUID = "00001525-1212-efde-1523-785feabcd124";
+constexpr Uuid128 LightHouse::PWR_SVC_UUID;
+constexpr Uuid128 LightHouse::PWR_CHAR_UUID;
+
+namespace
+{
+
+// The BLE stack takes UUIDs as text. The power characteristic is used on
+// every poll and toggle so its text is built once, anything else is only
+// touched by a full refresh and formatted into scratch.
+const std::string PWR_SVC_TEXT = LightHouse::PWR_SVC_UUID.ToString();
+const std::string PWR_CHAR_TEXT = LightHouse::PWR_CHAR_UUID.ToString();
+
+const std::string& UuidText(const Uuid128& uuid, std::string& scratch)
+{
+  if (LightHouse::PWR_SVC_UUID == uuid)
+  {
+    return PWR_SVC_TEXT;
+  }
+  else if (LightHouse::PWR_CHAR_UUID == uuid)
+  {
+    return PWR_CHAR_TEXT;
+  }
+
+  scratch = uuid.ToString();
+  return scratch;
+}
+
+}
 
 LightHouse::LightHouse(std::string address,
                        std::string identifier,
-                       SimpleBLE::Peripheral* peripheral) :
+                       std::shared_ptr<BLEPeripheral> peripheral) :
   Address(address),
   Identifier(identifier),
-  BLEPeripheral(*peripheral)
+  PowerState(POWER_UNKNOWN),
+  PowerValue(-1),
+  WakeFrom(POWER_UNKNOWN),
+  _StatusCallback(nullptr),
+  StatusContext(nullptr),
+  PowerIndex(NO_CHARACTERISTIC),
+  Peripheral(peripheral),
+  Adapter(0),
+  TraceId(Trace::PackAddress(address)),
+  LinkHeld(false),
+  ConnHits(0),
+  ConnMisses(0),
+  ConnReconnects(0),
+  ConnFailures(0),
+  NextProbe(0),
+  Subscribed(false),
+  NotifyUnsupported(false)
 {
+  LastWake.From = POWER_UNKNOWN;
+  LastWake.Elapsed = std::chrono::milliseconds(0);
+
+  // Subscriptions don't survive the link, fall back to polling until
+  // the next SubscribePowerState()
+  Peripheral->SetDisconnectedCallback([this]()
+  {
+    Subscribed = false;
+  });
 }
 
 LightHouse::~LightHouse()
 {
+  Disconnect();
+  Peripheral->SetDisconnectedCallback([]() {});
 }
 
 
@@ -30,174 +86,442 @@ std::string LightHouse::GetIdentifier() const
   return Identifier;
 }
 
-void LightHouse::AddCharacteristic(std::string service, std::string characteristic)
+void LightHouse::AddCharacteristic(const Uuid128& service, const Uuid128& characteristic)
 {
-  Services[service][characteristic] = "";
+  if (NO_CHARACTERISTIC != FindCharacteristic(service, characteristic))
+  {
+    return;
+  }
+
+  Characteristic entry;
+  entry.Service = service;
+  entry.Uuid = characteristic;
+  entry.Length = 0;
+  Characteristics.push_back(entry);
+
+  if ((PWR_SVC_UUID == service) && (PWR_CHAR_UUID == characteristic))
+  {
+    PowerIndex = Characteristics.size() - 1;
+  }
 }
 
-bool LightHouse::WriteCharacteristic(std::string service, 
-                                     std::string characteristic, 
-                                     std::string value)
+std::vector<std::pair<Uuid128, Uuid128>> LightHouse::GetCharacteristics() const
 {
-  // First attempt to connect
-  if (true == Connect())
+  std::vector<std::pair<Uuid128, Uuid128>> characteristics;
+  characteristics.reserve(Characteristics.size());
+  for (size_t i = 0; i < Characteristics.size(); ++i)
   {
-    BLEPeripheral.write_request(service, characteristic, value);
-    Disconnect();
-
-    return true;
+    characteristics.push_back(std::make_pair(Characteristics[i].Service, Characteristics[i].Uuid));
   }
 
-  return false;
+  return characteristics;
 }
 
-std::string LightHouse::ReadCharacteristic(std::string service, 
-                                           std::string characteristic)
+bool LightHouse::WriteCharacteristic(const Uuid128& service, 
+                                     const Uuid128& characteristic, 
+                                     const std::string& value)
 {
-  std::string value = "";
+  return WithConnection([&]()
+  {
+    LastWrite = std::chrono::steady_clock::now();
+    WriteValue(service, characteristic, value);
+  });
+}
 
-  service_itr s_itr = Services.find(service);
-  if (Services.end() != s_itr)
+std::string LightHouse::ReadCharacteristic(const Uuid128& service, 
+                                           const Uuid128& characteristic)
+{
+  size_t index = FindCharacteristic(service, characteristic);
+  if (NO_CHARACTERISTIC == index)
   {
-    characteristic_itr c_itr = s_itr->second.find(characteristic);
-    if (s_itr->second.end() != c_itr)
-    {
-      if (true == Connect())
-      {
-        Services[s_itr->first][c_itr->first] = BLEPeripheral.read(s_itr->first, c_itr->first);
-        Disconnect();
-      }
-      
-      value = c_itr->second;
-    }
+    return "";
   }
 
-  return value;
+  WithConnection([&]()
+  {
+    StoreValue(index, ReadValue(service, characteristic));
+  });
+
+  return std::string(Characteristics[index].Value, Characteristics[index].Length);
 }
 
+// Full refresh: discovers services on first use and re-reads every
+// characteristic. Use PollPowerState() for periodic status checks. True once
+// the power state was read.
 bool LightHouse::ReadCharacteristics()
 {
   if (true == Connect())
   {
     // Retrieve services/characteristics if we haven't done so
-    if (true == Services.empty())
+    if (true == Characteristics.empty())
     {
-      for (SimpleBLE::Service& s : BLEPeripheral.services())
+      TRACE_SPAN(span, DISCOVER_SERVICES, TraceId, 0);
+      try
       {
-        for (SimpleBLE::Characteristic& c : s.characteristics())
+        // The stack's text is parsed here, once per station
+        std::vector<std::pair<std::string, std::string>> characteristics = Peripheral->GetCharacteristics();
+        Characteristics.reserve(characteristics.size());
+        for (size_t i = 0; i < characteristics.size(); ++i)
         {
-          AddCharacteristic(s.uuid(), c.uuid());
+          Uuid128 service;
+          Uuid128 characteristic;
+          if ((true == Uuid128::Parse(characteristics[i].first, service)) &&
+              (true == Uuid128::Parse(characteristics[i].second, characteristic)))
+          {
+            AddCharacteristic(service, characteristic);
+          }
         }
+        TRACE_SPAN_OK(span);
+      }
+      catch (...)
+      {
+        // Left without characteristics, the station fails validation
+        TRACE_ERROR(OPERATION_FAILED, TraceId, 0);
+        Metrics::Increment(Metrics::DISCOVERY_FAILURES);
       }
     }
 
     // Retrieve values of characteristics
-    std::string debugStr = "Parsing " + Identifier + "\n";
-    OutputDebugStringA(debugStr.c_str());
-
-    for (service_itr s_itr = Services.begin(); s_itr != Services.end(); ++s_itr)
+    bool powerRead = false;
+    for (size_t i = 0; (i < Characteristics.size()) && (false == Token.IsCancelled()); ++i)
     {
-      for (characteristic_itr c_itr = s_itr->second.begin(); 
-           c_itr != s_itr->second.end();
-           ++c_itr)
+      // If we attempt to read something invalid, the backend throws an
+      // exception (counted by ReadValue). Only the power state matters, a
+      // refresh that didn't read it leaves the last status alone and fails.
+      try
       {
-        debugStr = s_itr->first + " " + c_itr->first + " = ";
-        
-        // If we attempt to read something invalid, SimpleBLE throws an exception...
-        try
-        {
-          Services[s_itr->first][c_itr->first] = BLEPeripheral.read(s_itr->first, c_itr->first);
-          debugStr += Services[s_itr->first][c_itr->first] + "\n";
-        }
-        catch (...)
+        StoreValue(i, ReadValue(Characteristics[i].Service, Characteristics[i].Uuid));
+      }
+      catch (...)
+      {
+        if (PowerIndex == i)
         {
-          debugStr += "ERROR\n";
+          TRACE_ERROR(OPERATION_FAILED, TraceId, 0);
         }
-        OutputDebugStringA(debugStr.c_str());
 
-        if ((PWR_SVC_UUID == s_itr->first) &&
-            (PWR_CHAR_UUID == c_itr->first))
-        {
-          std::string data = c_itr->second;
-          if (data.size())
-          {
-            switch (data[0])
-            {
-            case 0:
-              Status = "OFF (0x00)";
-              break;
-            default:
-              Status = "ON (" + std::to_string(data[0]) + ")";
-              break;
-            }
-          }
-          else
-          {
-            Status = "ERROR";
-          }
-        }
+        continue;
+      }
+
+      if (PowerIndex == i)
+      {
+        UpdateStatus(std::string(Characteristics[i].Value, Characteristics[i].Length));
+        powerRead = true;
       }
     }
 
-    Disconnect();
+    Release();
 
-    return true;
+    return powerRead;
   }
 
   return false;
 }
 
+// Lightweight poll: reads only the power characteristic
+bool LightHouse::PollPowerState()
+{
+  if (false == IsValidLighthouse())
+  {
+    return ReadCharacteristics();
+  }
+
+  std::string value;
+  bool res = WithConnection([&]()
+  {
+    value = ReadValue(PWR_SVC_UUID, PWR_CHAR_UUID);
+    StoreValue(PowerIndex, value);
+  });
+
+  if (true == res)
+  {
+    UpdateStatus(value);
+  }
+
+  return res;
+}
+
+// Ask the device to push power state changes. Returns false if the device
+// can't notify/indicate, in which case callers keep polling.
+bool LightHouse::SubscribePowerState()
+{
+  if ((true == Subscribed) || (true == NotifyUnsupported))
+  {
+    return Subscribed;
+  }
+
+  if ((false == IsValidLighthouse()) || (false == Connect()))
+  {
+    return false;
+  }
+
+  BLEPeripheral::PayloadCallback onPayload = [this](std::string payload)
+  {
+    TRACE_INFO(NOTIFY, TraceId, Trace::PackValue(PWR_CHAR_UUID, payload));
+    Metrics::Increment(Metrics::NOTIFICATIONS);
+    if ((true == UpdateStatus(payload)) && (nullptr != _StatusCallback))
+    {
+      _StatusCallback(this, StatusContext);
+    }
+  };
+
+  TRACE_SPAN(span, SUBSCRIBE, TraceId, 0);
+  try
+  {
+    Peripheral->Notify(PWR_SVC_TEXT, PWR_CHAR_TEXT, onPayload);
+    Subscribed = true;
+    TRACE_SPAN_OK(span);
+  }
+  catch (...)
+  {
+    try
+    {
+      Peripheral->Indicate(PWR_SVC_TEXT, PWR_CHAR_TEXT, onPayload);
+      Subscribed = true;
+      TRACE_SPAN_OK(span);
+    }
+    catch (...)
+    {
+      // Only give up for good if the link is fine and the device refused
+      if (true == Peripheral->IsConnected())
+      {
+        TRACE_INFO(SUBSCRIBE_UNSUPPORTED, TraceId, 0);
+        NotifyUnsupported = true;
+      }
+    }
+  }
+
+  Release();
+
+  return Subscribed;
+}
+
+bool LightHouse::IsSubscribed() const
+{
+  return Subscribed;
+}
+
+void LightHouse::SetStatusCallback(StatusCallback cb, void* pContext)
+{
+  StatusContext = pContext;
+  _StatusCallback = cb;
+}
+
+void LightHouse::SetCancelToken(CancelToken token)
+{
+  Token = token;
+}
+
+// Index into the manager's adapter list of the adapter Peripheral belongs to
+void LightHouse::SetAdapter(size_t adapter)
+{
+  Adapter = adapter;
+}
+
+size_t LightHouse::GetAdapter() const
+{
+  return Adapter;
+}
+
+// Signal strength of the last advertisement the adapter heard
+int16_t LightHouse::GetRssi() const
+{
+  return Peripheral->GetRssi();
+}
+
 bool LightHouse::IsValidLighthouse() const
 {
-  service_itr s_itr = Services.find(PWR_SVC_UUID);
-  if (Services.end() != s_itr)
+  return NO_CHARACTERISTIC != PowerIndex;
+}
+
+LightHouse::PowerStateEnum LightHouse::DecodePowerState(const std::string& value)
+{
+  if (true == value.empty())
   {
-    characteristic_itr c_itr = s_itr->second.find(PWR_CHAR_UUID);
-    return (c_itr != s_itr->second.end());
+    return POWER_UNKNOWN;
   }
 
-  return false;
+  switch (static_cast<uint8_t>(value[0]))
+  {
+  case 0x00:
+    return POWER_SLEEP;
+  case 0x01:
+    return POWER_WAKING;
+  case 0x02:
+    return POWER_STANDBY;
+  case 0x08:
+  case 0x09:
+    return POWER_BOOTING;
+  case 0x0b:
+    return POWER_ON;
+  default:
+    return POWER_UNKNOWN;
+  }
+}
+
+const char* LightHouse::GetPowerStateName(PowerStateEnum state)
+{
+  static const char* NAMES[] = { "Unknown", "Sleeping", "Waking", "Standby", "Booting", "On" };
+  return NAMES[state];
+}
+
+LightHouse::PowerStateEnum LightHouse::GetPowerState() const
+{
+  std::lock_guard<std::mutex> lock(StatusLock);
+  return PowerState;
+}
+
+// Drawing power, or about to
+bool LightHouse::IsPowered() const
+{
+  PowerStateEnum state = GetPowerState();
+  return (POWER_WAKING == state) || (POWER_BOOTING == state) || (POWER_ON == state);
 }
 
-void LightHouse::SetStatus(std::string status)
+LightHouse::WakeStats LightHouse::GetLastWake() const
 {
-  Status = status;
+  std::lock_guard<std::mutex> lock(StatusLock);
+  return LastWake;
 }
 
+// For display, e.g. "On (0x0b)"
 std::string LightHouse::GetStatus() const
 {
-  return Status;
+  std::lock_guard<std::mutex> lock(StatusLock);
+  if (0 > PowerValue)
+  {
+    return "ERROR";
+  }
+
+  char status[32];
+  snprintf(status, sizeof(status), "%s (0x%02x)", GetPowerStateName(PowerState), PowerValue);
+  return status;
+}
+
+std::chrono::steady_clock::time_point LightHouse::GetLastSeen() const
+{
+  std::lock_guard<std::mutex> lock(StatusLock);
+  return LastSeen;
+}
+
+bool LightHouse::PowerOff(PowerTimings& timings)
+{
+  return SetPower(LightHouse::PWR_OFF, timings);
+}
+
+bool LightHouse::PowerOn(PowerTimings& timings)
+{
+  return SetPower(LightHouse::PWR_ON, timings);
 }
 
-bool LightHouse::PowerOff()
+bool LightHouse::Standby(PowerTimings& timings)
 {
-  if (true == WriteCharacteristic(LightHouse::PWR_SVC_UUID,
-                                  LightHouse::PWR_CHAR_UUID,
-                                  std::string(1, LightHouse::PWR_OFF)))
+  return SetPower(LightHouse::PWR_STANDBY, timings);
+}
+
+bool LightHouse::CloseIfIdle(std::chrono::milliseconds idleTimeout)
+{
+  // A subscribed link is what delivers the power state, keep it open
+  if ((true == LinkHeld) &&
+      (false == Subscribed) &&
+      (idleTimeout <= std::chrono::steady_clock::now() - LastUsed))
   {
-    if (true == ReadCharacteristics())
+    Disconnect();
+    return true;
+  }
+
+  return false;
+}
+
+LightHouse::HealthStats LightHouse::GetHealth() const
+{
+  HealthStats health;
+  health.Failures = ConnFailures;
+  health.NextProbe = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(NextProbe));
+  health.State = (0 == health.Failures) ? HEALTHY :
+                 (BREAKER_THRESHOLD > health.Failures) ? DEGRADED : UNREACHABLE;
+  return health;
+}
+
+bool LightHouse::IsProbeDue() const
+{
+  return NextProbe <= std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+LightHouse::ConnectionStats LightHouse::GetConnectionStats() const
+{
+  ConnectionStats stats;
+  stats.Hits = ConnHits;
+  stats.Misses = ConnMisses;
+  stats.Reconnects = ConnReconnects;
+  return stats;
+}
+
+// Returns true if the power state changed. Also completes a pending wake
+// measurement once the station reports ON, or drops it if the station went
+// back to sleep or standby first.
+bool LightHouse::UpdateStatus(const std::string& data)
+{
+  PowerStateEnum state = DecodePowerState(data);
+  int value = (true == data.empty()) ? -1 : static_cast<uint8_t>(data[0]);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lock(StatusLock);
+  bool changed = (value != PowerValue);
+  PowerState = state;
+  PowerValue = value;
+  LastSeen = now;
+
+  if (POWER_UNKNOWN != WakeFrom)
+  {
+    if (POWER_ON == state)
     {
-      if (std::string::npos != Status.find("OFF"))
-      {
-        return true;
-      }
+      LastWake.From = WakeFrom;
+      LastWake.Elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - WakeStart);
+      Metrics::Observe((POWER_STANDBY == WakeFrom) ? Metrics::READY_FROM_STANDBY : Metrics::READY_FROM_SLEEP,
+                       now - WakeStart);
+      WakeFrom = POWER_UNKNOWN;
+    }
+    else if ((POWER_SLEEP == state) || (POWER_STANDBY == state))
+    {
+      WakeFrom = POWER_UNKNOWN;
     }
   }
 
-  return false;
+  return changed;
+}
+
+std::chrono::steady_clock::time_point LightHouse::GetLastWriteTime() const
+{
+  return LastWrite;
 }
 
-bool LightHouse::PowerOn()
+template <typename Operation>
+bool LightHouse::WithConnection(Operation op)
 {
-  if (true == WriteCharacteristic(LightHouse::PWR_SVC_UUID,
-                                  LightHouse::PWR_CHAR_UUID,
-                                  std::string(1, LightHouse::PWR_ON)))
+  // A kept-open link may have gone stale without us noticing, so a failed
+  // operation drops the link and is retried once on a fresh connection.
+  for (uint32_t attempt = 0; attempt < 2; ++attempt)
   {
-    if (true == ReadCharacteristics())
+    if (false == Connect())
+    {
+      break;
+    }
+
+    try
     {
-      if (std::string::npos != Status.find("ON"))
+      op();
+      Release();
+      return true;
+    }
+    catch (...)
+    {
+      TRACE_ERROR(OPERATION_FAILED, TraceId, attempt);
+      Metrics::Increment(Metrics::OPERATION_FAILURES);
+      Disconnect();
+
+      if (0 == attempt)
       {
-        return true;
+        ++ConnReconnects;
       }
     }
   }
@@ -207,32 +531,268 @@ bool LightHouse::PowerOn()
 
 bool LightHouse::Connect()
 {
+  // Every BLE operation starts here, so this is where a shutdown stops us
+  if (true == Token.IsCancelled())
+  {
+    return false;
+  }
+
+  // An unreachable station isn't tried again until its next probe
+  if ((BREAKER_THRESHOLD <= ConnFailures) && (false == IsProbeDue()))
+  {
+    return false;
+  }
+
   try
   {
-    if (false == BLEPeripheral.is_connected())
+    if (true == Peripheral->IsConnected())
     {
-      BLEPeripheral.connect();
+      ++ConnHits;
+      Metrics::Increment(Metrics::CONNECT_REUSES);
+    }
+    else
+    {
+      // The link was dropped by the device while we were holding it
+      if (true == LinkHeld)
+      {
+        ++ConnReconnects;
+      }
+
+      ++ConnMisses;
+
+      TRACE_SPAN(span, CONNECT, TraceId, 0);
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      Peripheral->Connect();
+      Metrics::Observe(Metrics::CONNECT_LATENCY, std::chrono::steady_clock::now() - start);
+      TRACE_SPAN_OK(span);
+
+      Metrics::Increment((true == Peripheral->IsConnected()) ? Metrics::CONNECTS : Metrics::CONNECT_FAILURES);
     }
   }
   catch (...)
   {
-    OutputDebugStringA("Exception thrown while connecting\n");
+    Metrics::Increment(Metrics::CONNECT_EXCEPTIONS);
+    Metrics::Increment(Metrics::CONNECT_FAILURES);
   }
 
-  return BLEPeripheral.is_connected();
+  LinkHeld = Peripheral->IsConnected();
+  LastUsed = std::chrono::steady_clock::now();
+  RecordConnectResult(LinkHeld);
+
+  return LinkHeld;
+}
+
+void LightHouse::Release()
+{
+  // Keep the link open for the next operation, CloseIfIdle() tears it down
+  LastUsed = std::chrono::steady_clock::now();
 }
 
 void LightHouse::Disconnect()
 {
+  LinkHeld = false;
+  Subscribed = false;
+
   try
   {
-    if (true == BLEPeripheral.is_connected())
+    if (true == Peripheral->IsConnected())
     {
-      BLEPeripheral.disconnect();
+      TRACE_SPAN(span, DISCONNECT, TraceId, 0);
+      Peripheral->Disconnect();
+      TRACE_SPAN_OK(span);
+      Metrics::Increment(Metrics::DISCONNECTS);
     }
   }
   catch (...)
   {
-    OutputDebugStringA("Exception thrown while disconnecting\n");
+    Metrics::Increment(Metrics::DISCONNECT_EXCEPTIONS);
   }
-}
\ No newline at end of file
+}
+
+size_t LightHouse::FindCharacteristic(const Uuid128& service, const Uuid128& characteristic) const
+{
+  for (size_t i = 0; i < Characteristics.size(); ++i)
+  {
+    if ((characteristic == Characteristics[i].Uuid) && (service == Characteristics[i].Service))
+    {
+      return i;
+    }
+  }
+
+  return NO_CHARACTERISTIC;
+}
+
+void LightHouse::StoreValue(size_t index, const std::string& value)
+{
+  Characteristic& entry = Characteristics[index];
+  entry.Length = static_cast<uint8_t>((VALUE_CAPACITY < value.size()) ? VALUE_CAPACITY : value.size());
+  memcpy(entry.Value, value.data(), entry.Length);
+}
+
+std::string LightHouse::ReadValue(const Uuid128& service, const Uuid128& characteristic)
+{
+  TRACE_SPAN(span, READ, TraceId, Trace::PackValue(characteristic, ""));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::string serviceScratch;
+  std::string characteristicScratch;
+  std::string value;
+  try
+  {
+    value = Peripheral->Read(UuidText(service, serviceScratch),
+                             UuidText(characteristic, characteristicScratch));
+  }
+  catch (...)
+  {
+    Metrics::Increment(Metrics::READ_FAILURES);
+    throw;
+  }
+
+  Metrics::Observe(Metrics::READ_LATENCY, std::chrono::steady_clock::now() - start);
+  Metrics::Increment(Metrics::READS);
+  TRACE_SPAN_OK(span);
+  TRACE_DEBUG(VALUE, TraceId, Trace::PackValue(characteristic, value));
+
+  return value;
+}
+
+void LightHouse::WriteValue(const Uuid128& service,
+                            const Uuid128& characteristic,
+                            const std::string& value,
+                            bool request)
+{
+  TRACE_SPAN(span, WRITE, TraceId, Trace::PackValue(characteristic, value));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::string serviceScratch;
+  std::string characteristicScratch;
+  const std::string& serviceText = UuidText(service, serviceScratch);
+  const std::string& characteristicText = UuidText(characteristic, characteristicScratch);
+  try
+  {
+    if (true == request)
+    {
+      Peripheral->WriteRequest(serviceText, characteristicText, value);
+    }
+    else
+    {
+      Peripheral->WriteCommand(serviceText, characteristicText, value);
+    }
+  }
+  catch (...)
+  {
+    Metrics::Increment(Metrics::WRITE_FAILURES);
+    throw;
+  }
+
+  Metrics::Observe(Metrics::WRITE_LATENCY, std::chrono::steady_clock::now() - start);
+  Metrics::Increment(Metrics::WRITES);
+  TRACE_SPAN_OK(span);
+}
+
+void LightHouse::RecordConnectResult(bool connected)
+{
+  if (true == connected)
+  {
+    ConnFailures = 0;
+    NextProbe = 0;
+    return;
+  }
+
+  uint32_t failures = ++ConnFailures;
+  if (BREAKER_THRESHOLD > failures)
+  {
+    return;
+  }
+
+  if (BREAKER_THRESHOLD == failures)
+  {
+    Metrics::Increment(Metrics::BREAKER_OPENS);
+  }
+
+  // Doubles with every failed probe up to the cap
+  uint32_t doublings = std::min<uint32_t>(failures - BREAKER_THRESHOLD, 16);
+  std::chrono::milliseconds backoff(std::min<uint64_t>(static_cast<uint64_t>(BACKOFF_BASE_MS) << doublings,
+                                                       BACKOFF_MAX_MS));
+  NextProbe = (std::chrono::steady_clock::now() + backoff).time_since_epoch().count();
+}
+
+// Writes the power state on the open link and reads it back once. The first
+// write isn't acknowledged, the read tells us whether it landed; only if it
+// disagrees is the write repeated, acknowledged this time.
+bool LightHouse::SetPower(char state, PowerTimings& timings)
+{
+  timings.Connect = std::chrono::microseconds(0);
+  timings.Write = std::chrono::microseconds(0);
+  timings.Verify = std::chrono::microseconds(0);
+  timings.Attempts = 0;
+
+  if (false == IsValidLighthouse())
+  {
+    return false;
+  }
+
+  // Only a wake from a known resting state is timed
+  PowerStateEnum from = GetPowerState();
+  if ((POWER_SLEEP != from) && (POWER_STANDBY != from))
+  {
+    from = POWER_UNKNOWN;
+  }
+
+  const std::string command(1, state);
+  for (uint32_t attempt = 0; attempt < POWER_ATTEMPTS; ++attempt)
+  {
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    bool connected = Connect();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    timings.Connect += std::chrono::duration_cast<std::chrono::microseconds>(end - begin);
+
+    if (false == connected)
+    {
+      continue;
+    }
+
+    ++timings.Attempts;
+    try
+    {
+      begin = end;
+      WriteValue(PWR_SVC_UUID, PWR_CHAR_UUID, command, 0 < attempt);
+      end = std::chrono::steady_clock::now();
+      timings.Write += std::chrono::duration_cast<std::chrono::microseconds>(end - begin);
+      LastWrite = end;
+
+      begin = end;
+      std::string value = ReadValue(PWR_SVC_UUID, PWR_CHAR_UUID);
+      end = std::chrono::steady_clock::now();
+      timings.Verify += std::chrono::duration_cast<std::chrono::microseconds>(end - begin);
+
+      StoreValue(PowerIndex, value);
+      PowerStateEnum reported = DecodePowerState(value);
+      if ((PWR_ON == state) && (POWER_UNKNOWN != from) && (POWER_ON != reported))
+      {
+        std::lock_guard<std::mutex> lock(StatusLock);
+        WakeStart = LastWrite;
+        WakeFrom = from;
+      }
+
+      UpdateStatus(value);
+      Release();
+
+      // Waking and booting mean the write landed and the station is on its way
+      if (((PWR_ON == state) && ((POWER_WAKING == reported) || (POWER_BOOTING == reported) || (POWER_ON == reported))) ||
+          ((PWR_STANDBY == state) && (POWER_STANDBY == reported)) ||
+          ((PWR_OFF == state) && (POWER_SLEEP == reported)))
+      {
+        return true;
+      }
+
+      Metrics::Increment(Metrics::POWER_RETRIES);
+    }
+    catch (...)
+    {
+      TRACE_ERROR(OPERATION_FAILED, TraceId, attempt);
+      Metrics::Increment(Metrics::OPERATION_FAILURES);
+      Disconnect();
+    }
+  }
+
+  return false;
+}
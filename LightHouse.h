@@ -1,47 +1,192 @@
 #pragma once
+#include "AsyncMgr.h"
+#include "BLEBackend.h"
+#include "Uuid128.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <simpleble/Peripheral.h>
+#include <utility>
+#include <vector>
 
 class LightHouse
 {
 public:
 
   static const char* LIGHTHOUSE_ID;
-  static const char* PWR_SVC_UUID;
-  static const char* PWR_CHAR_UUID;
-  static const char  PWR_ON  = 0x01;
-  static const char  PWR_OFF = 0x00;
+  static constexpr Uuid128 PWR_SVC_UUID  = Uuid128::FromString("00001523-1212-efde-1523-785feabcd124");
+  static constexpr Uuid128 PWR_CHAR_UUID = Uuid128::FromString("00001525-1212-efde-1523-785feabcd124");
+  // Power characteristic writes
+  static const char  PWR_OFF     = 0x00;
+  static const char  PWR_ON      = 0x01;
+  static const char  PWR_STANDBY = 0x02;
+  static const uint32_t POWER_ATTEMPTS = 3;
+  static const uint32_t BREAKER_THRESHOLD = 3;
+  static const uint32_t BACKOFF_BASE_MS = 2000;
+  static const uint32_t BACKOFF_MAX_MS = 60000;
+
+  // A value fits the default ATT payload, longer reads are truncated
+  static const size_t VALUE_CAPACITY = 20;
+
+  // Power characteristic reads. A station woken from sleep reports WAKING
+  // (0x01), then BOOTING (0x08/0x09) while it spins up, and ON (0x0b) once
+  // it's tracking. Standby (0x02) keeps enough running to get back to ON
+  // much faster than from sleep, for a little more idle power.
+  enum PowerStateEnum
+  {
+    POWER_UNKNOWN,
+    POWER_SLEEP,
+    POWER_WAKING,
+    POWER_STANDBY,
+    POWER_BOOTING,
+    POWER_ON
+  };
+
+  // Time from the wake write to the station reporting ON, and the state it
+  // was woken from. Zero until the first measured wake.
+  struct WakeStats
+  {
+    PowerStateEnum From;
+    std::chrono::milliseconds Elapsed;
+  };
+
+  // Connection reuse counters. Hits and misses count every acquisition of
+  // the link, reconnects count the acquisitions that had to recover a link
+  // which dropped or failed while it was being kept open.
+  struct ConnectionStats
+  {
+    uint64_t Hits;
+    uint64_t Misses;
+    uint64_t Reconnects;
+  };
+
+  // Consecutive connection failures trip the breaker after
+  // BREAKER_THRESHOLD. From then on Connect() fails straight away until
+  // NextProbe, which backs off exponentially with every failed probe. A
+  // successful connection closes it again.
+  enum HealthEnum
+  {
+    HEALTHY,
+    DEGRADED,
+    UNREACHABLE
+  };
+
+  struct HealthStats
+  {
+    HealthEnum State;
+    uint32_t Failures;
+    std::chrono::steady_clock::time_point NextProbe;
+  };
+
+  // Time spent in each phase of a power toggle, summed over attempts.
+  // More than one attempt means the verification read disagreed or the
+  // link failed part way.
+  struct PowerTimings
+  {
+    std::chrono::microseconds Connect;
+    std::chrono::microseconds Write;
+    std::chrono::microseconds Verify;
+    uint32_t Attempts;
+  };
+
+  // Invoked from the BLE backend's thread when a pushed power state differs
+  // from the current status
+  typedef void(*StatusCallback)(LightHouse* lighthouse, void* pContext);
 
   LightHouse(std::string address, 
              std::string identifier, 
-             SimpleBLE::Peripheral* peripheral);
+             std::shared_ptr<BLEPeripheral> peripheral);
   ~LightHouse();
 
   std::string GetAddress() const;
   std::string GetIdentifier() const;
-  void AddCharacteristic(std::string service, std::string characteristic);
-  bool WriteCharacteristic(std::string service, std::string characteristic, std::string value);
-  std::string ReadCharacteristic(std::string service, std::string characteristic);
+  void AddCharacteristic(const Uuid128& service, const Uuid128& characteristic);
+  std::vector<std::pair<Uuid128, Uuid128>> GetCharacteristics() const;
+  bool WriteCharacteristic(const Uuid128& service, const Uuid128& characteristic, const std::string& value);
+  std::string ReadCharacteristic(const Uuid128& service, const Uuid128& characteristic);
   bool ReadCharacteristics();
+  bool PollPowerState();
+  bool SubscribePowerState();
+  bool IsSubscribed() const;
+  void SetStatusCallback(StatusCallback cb, void* pContext);
+  void SetCancelToken(CancelToken token);
+  void SetAdapter(size_t adapter);
+  size_t GetAdapter() const;
+  int16_t GetRssi() const;
   bool IsValidLighthouse() const;
-  void SetStatus(std::string status);
+  static PowerStateEnum DecodePowerState(const std::string& value);
+  static const char* GetPowerStateName(PowerStateEnum state);
+  PowerStateEnum GetPowerState() const;
+  bool IsPowered() const;
+  WakeStats GetLastWake() const;
   std::string GetStatus() const;
-  bool PowerOff();
-  bool PowerOn();
+  std::chrono::steady_clock::time_point GetLastSeen() const;
+  bool PowerOff(PowerTimings& timings);
+  bool PowerOn(PowerTimings& timings);
+  bool Standby(PowerTimings& timings);
+  bool CloseIfIdle(std::chrono::milliseconds idleTimeout);
+  ConnectionStats GetConnectionStats() const;
+  HealthStats GetHealth() const;
+  bool IsProbeDue() const;
+  std::chrono::steady_clock::time_point GetLastWriteTime() const;
 
 private:
 
+  template <typename Operation>
+  bool WithConnection(Operation op);
   bool Connect();
+  void Release();
   void Disconnect();
+  std::string ReadValue(const Uuid128& service, const Uuid128& characteristic);
+  void WriteValue(const Uuid128& service, const Uuid128& characteristic,
+                  const std::string& value, bool request = true);
+  size_t FindCharacteristic(const Uuid128& service, const Uuid128& characteristic) const;
+  void StoreValue(size_t index, const std::string& value);
+  bool SetPower(char state, PowerTimings& timings);
+  bool UpdateStatus(const std::string& data);
+  void RecordConnectResult(bool connected);
 
   std::string Address;
   std::string Identifier;
-  std::string Status;
+  mutable std::mutex StatusLock;
+  PowerStateEnum PowerState;
+  int PowerValue;
+  std::chrono::steady_clock::time_point LastSeen;
+  std::chrono::steady_clock::time_point WakeStart;
+  PowerStateEnum WakeFrom;
+  WakeStats LastWake;
+  StatusCallback _StatusCallback;
+  void* StatusContext;
+  CancelToken Token;
+
+  // Last value read from each characteristic, in discovery order. A
+  // station has a dozen or so, a linear search beats any index.
+  struct Characteristic
+  {
+    Uuid128 Service;
+    Uuid128 Uuid;
+    uint8_t Length;
+    char Value[VALUE_CAPACITY];
+  };
+
+  static const size_t NO_CHARACTERISTIC = SIZE_MAX;
 
-  std::map<std::string, std::map<std::string, std::string>> Services;
-  typedef std::map<std::string, std::map<std::string, std::string>>::const_iterator service_itr;
-  typedef std::map<std::string, std::string>::const_iterator characteristic_itr;
+  std::vector<Characteristic> Characteristics;
+  size_t PowerIndex;
 
-  SimpleBLE::Peripheral& BLEPeripheral;
+  std::shared_ptr<BLEPeripheral> Peripheral;
+  size_t Adapter;
+  uint64_t TraceId;
+  bool LinkHeld;
+  std::chrono::steady_clock::time_point LastUsed;
+  std::chrono::steady_clock::time_point LastWrite;
+  std::atomic<uint64_t> ConnHits;
+  std::atomic<uint64_t> ConnMisses;
+  std::atomic<uint64_t> ConnReconnects;
+  std::atomic<uint32_t> ConnFailures;
+  std::atomic<std::chrono::steady_clock::rep> NextProbe;
+  std::atomic<bool> Subscribed;
+  bool NotifyUnsupported;
 };
 
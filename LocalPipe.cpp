@@ -0,0 +1,494 @@
+#include "LocalPipe.h"
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <sddl.h>
+#pragma comment(lib, "advapi32.lib")
+#else
+#include <cstdlib>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  const intptr_t NO_ENDPOINT = -1;
+
+#ifdef _WIN32
+  // Full access for SYSTEM, Administrators and the pipe's owner (the service
+  // account, or the user running the daemon in the foreground), nothing for
+  // anyone else. Protected so no inherited entry widens it.
+  const char PIPE_SDDL[] = "D:P(A;;GA;;;SY)(A;;GA;;;BA)(A;;GA;;;OW)";
+
+  // Waits for an overlapped read or write, cancelling it after timeoutMs
+  bool Complete(HANDLE pipe, OVERLAPPED& overlapped, BOOL started, uint32_t timeoutMs, DWORD& bytes)
+  {
+    if ((FALSE == started) && (ERROR_IO_PENDING != GetLastError()))
+    {
+      return false;
+    }
+
+    if (WAIT_OBJECT_0 != WaitForSingleObject(overlapped.hEvent, timeoutMs))
+    {
+      CancelIo(pipe);
+      GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+      return false;
+    }
+
+    return TRUE == GetOverlappedResult(pipe, &overlapped, &bytes, FALSE);
+  }
+
+  bool ReadSome(HANDLE pipe, char* buffer, DWORD size, uint32_t timeoutMs, DWORD& bytes)
+  {
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (nullptr == overlapped.hEvent)
+    {
+      return false;
+    }
+
+    bytes = 0;
+    bool success = Complete(pipe, overlapped, ReadFile(pipe, buffer, size, nullptr, &overlapped), timeoutMs, bytes);
+
+    // Callers tell a closed pipe from a failure by the error code
+    DWORD error = GetLastError();
+    CloseHandle(overlapped.hEvent);
+    SetLastError(error);
+    return success;
+  }
+
+  bool SendAll(HANDLE pipe, const std::string& data, uint32_t timeoutMs)
+  {
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (nullptr == overlapped.hEvent)
+    {
+      return false;
+    }
+
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+      DWORD n = 0;
+      ResetEvent(overlapped.hEvent);
+      BOOL started = WriteFile(pipe, data.data() + sent, static_cast<DWORD>(data.size() - sent), nullptr, &overlapped);
+      if ((false == Complete(pipe, overlapped, started, timeoutMs, n)) || (0 == n))
+      {
+        break;
+      }
+
+      sent += n;
+    }
+
+    CloseHandle(overlapped.hEvent);
+    return sent == data.size();
+  }
+#else
+  void SetTimeout(int s, uint32_t timeoutMs)
+  {
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  }
+
+  bool Address(const std::string& path, sockaddr_un& addr)
+  {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (sizeof(addr.sun_path) <= path.size())
+    {
+      return false;
+    }
+
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+  }
+
+  bool Connect(int s, const sockaddr_un& addr)
+  {
+    return 0 == connect(s, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+  }
+
+  bool SendAll(int s, const std::string& data)
+  {
+#ifdef MSG_NOSIGNAL
+    // A client that hangs up early must not take the daemon down with SIGPIPE
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+      ssize_t n = send(s, data.data() + sent, data.size() - sent, flags);
+      if (0 >= n)
+      {
+        return false;
+      }
+
+      sent += static_cast<size_t>(n);
+    }
+
+    return true;
+  }
+#endif
+}
+
+std::string LocalPipe::DefaultPath(const std::string& name)
+{
+#ifdef _WIN32
+  return "\\\\.\\pipe\\" + name;
+#else
+  // The runtime directory is private to the user already, /tmp is shared so
+  // the name carries the uid to keep users from colliding
+  const char* runtime = getenv("XDG_RUNTIME_DIR");
+  if ((nullptr != runtime) && ('\0' != runtime[0]))
+  {
+    return std::string(runtime) + "/" + name + ".sock";
+  }
+
+  return "/tmp/" + name + "-" + std::to_string(getuid()) + ".sock";
+#endif
+}
+
+LocalPipe* LocalPipe::Create(const std::string& path,
+                             std::string terminator,
+                             RequestHandler handler,
+                             void* pContext)
+{
+  LocalPipe* instance = new LocalPipe(path, terminator, handler, pContext);
+  if (false == instance->Listen())
+  {
+    delete instance;
+    return nullptr;
+  }
+
+  instance->Worker = std::thread(&LocalPipe::ServeLoop, instance);
+  return instance;
+}
+
+void LocalPipe::Destroy(LocalPipe* instance)
+{
+  delete instance;
+}
+
+bool LocalPipe::Send(const std::string& path, const std::string& request, std::string& response)
+{
+#ifdef _WIN32
+  HANDLE pipe = INVALID_HANDLE_VALUE;
+  for (;;)
+  {
+    pipe = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+    if ((INVALID_HANDLE_VALUE != pipe) ||
+        (ERROR_PIPE_BUSY != GetLastError()) ||
+        (FALSE == WaitNamedPipeA(path.c_str(), CLIENT_TIMEOUT_MS * 10)))
+    {
+      break;
+    }
+  }
+
+  if (INVALID_HANDLE_VALUE == pipe)
+  {
+    return false;
+  }
+
+  bool success = false;
+  if (true == SendAll(pipe, request, CLIENT_TIMEOUT_MS * 10))
+  {
+    // The server disconnects once the response is written
+    response.clear();
+    char buffer[1024];
+    DWORD n = 0;
+    while ((true == ReadSome(pipe, buffer, sizeof(buffer), CLIENT_TIMEOUT_MS * 10, n)) && (0 < n))
+    {
+      response.append(buffer, n);
+    }
+
+    success = (ERROR_BROKEN_PIPE == GetLastError()) || (ERROR_PIPE_NOT_CONNECTED == GetLastError());
+  }
+
+  CloseHandle(pipe);
+  return success;
+#else
+  sockaddr_un addr;
+  if (false == Address(path, addr))
+  {
+    return false;
+  }
+
+  bool success = false;
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (0 <= s)
+  {
+    SetTimeout(s, CLIENT_TIMEOUT_MS * 10);
+
+    if ((true == Connect(s, addr)) && (true == SendAll(s, request)))
+    {
+      // The server closes the connection once the response is written
+      response.clear();
+      char buffer[1024];
+      ssize_t n = 0;
+      while (0 < (n = recv(s, buffer, sizeof(buffer), 0)))
+      {
+        response.append(buffer, static_cast<size_t>(n));
+      }
+
+      success = (0 == n);
+    }
+
+    close(s);
+  }
+
+  return success;
+#endif
+}
+
+LocalPipe::LocalPipe(const std::string& path, std::string terminator, RequestHandler handler, void* pContext) :
+  Path(path),
+  Terminator(terminator),
+  _RequestHandler(handler),
+  RequestContext(pContext),
+  Endpoint(NO_ENDPOINT),
+  Owned(false),
+  Stopping(false)
+{
+}
+
+LocalPipe::~LocalPipe()
+{
+  Stopping = true;
+  if (true == Worker.joinable())
+  {
+    Worker.join();
+  }
+
+#ifdef _WIN32
+  if (NO_ENDPOINT != Endpoint)
+  {
+    CloseHandle(reinterpret_cast<HANDLE>(Endpoint));
+  }
+#else
+  if (NO_ENDPOINT != Endpoint)
+  {
+    close(static_cast<int>(Endpoint));
+  }
+
+  // Only the socket this instance bound, never one another daemon serves
+  if (true == Owned)
+  {
+    unlink(Path.c_str());
+  }
+#endif
+}
+
+bool LocalPipe::Listen()
+{
+#ifdef _WIN32
+  SECURITY_ATTRIBUTES security;
+  security.nLength = sizeof(security);
+  security.lpSecurityDescriptor = nullptr;
+  security.bInheritHandle = FALSE;
+  if (FALSE == ConvertStringSecurityDescriptorToSecurityDescriptorA(PIPE_SDDL, SDDL_REVISION_1, &security.lpSecurityDescriptor, nullptr))
+  {
+    return false;
+  }
+
+  // FIRST_PIPE_INSTANCE fails if someone else already created the name, so a
+  // squatter can't sit in front of the daemon with a weaker DACL
+  HANDLE pipe = CreateNamedPipeA(Path.c_str(),
+                                 PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                 PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                 1,
+                                 static_cast<DWORD>(MAX_REQUEST_SIZE),
+                                 static_cast<DWORD>(MAX_REQUEST_SIZE),
+                                 0,
+                                 &security);
+  LocalFree(security.lpSecurityDescriptor);
+  if (INVALID_HANDLE_VALUE == pipe)
+  {
+    return false;
+  }
+
+  Endpoint = reinterpret_cast<intptr_t>(pipe);
+  Owned = true;
+  return true;
+#else
+  sockaddr_un addr;
+  if (false == Address(Path, addr))
+  {
+    return false;
+  }
+
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (0 > s)
+  {
+    return false;
+  }
+
+  Endpoint = s;
+
+  // A socket left behind by a crashed daemon is replaced, a live one or any
+  // other kind of file is not
+  struct stat info;
+  if ((0 == lstat(Path.c_str(), &info)) && (S_ISSOCK(info.st_mode)))
+  {
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = (0 <= probe) && (true == Connect(probe, addr));
+    if (0 <= probe)
+    {
+      close(probe);
+    }
+
+    if (true == live)
+    {
+      return false;
+    }
+
+    unlink(Path.c_str());
+  }
+
+  if (0 != bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)))
+  {
+    return false;
+  }
+
+  Owned = true;
+
+  // Connecting needs write access to the socket file, and nobody can connect
+  // before listen(), so restricting it here leaves no window
+  return (0 == chmod(Path.c_str(), S_IRUSR | S_IWUSR)) &&
+         (0 == listen(s, 4));
+#endif
+}
+
+void LocalPipe::ServeLoop()
+{
+#ifdef _WIN32
+  HANDLE pipe = reinterpret_cast<HANDLE>(Endpoint);
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+  if (nullptr == overlapped.hEvent)
+  {
+    return;
+  }
+
+  while (false == Stopping)
+  {
+    ResetEvent(overlapped.hEvent);
+    BOOL connected = ConnectNamedPipe(pipe, &overlapped);
+    DWORD error = GetLastError();
+    DWORD bytes = 0;
+    if ((FALSE == connected) && (ERROR_IO_PENDING == error))
+    {
+      // Wakes up periodically so Destroy() can stop the loop
+      while ((false == Stopping) && (WAIT_TIMEOUT == WaitForSingleObject(overlapped.hEvent, STOP_CHECK_MS)))
+      {
+      }
+
+      if (true == Stopping)
+      {
+        CancelIo(pipe);
+        GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+        break;
+      }
+
+      connected = GetOverlappedResult(pipe, &overlapped, &bytes, FALSE);
+    }
+    else if (ERROR_PIPE_CONNECTED == error)
+    {
+      // The client got in between DisconnectNamedPipe() and here
+      connected = TRUE;
+    }
+
+    if (FALSE != connected)
+    {
+      Serve(Endpoint);
+    }
+
+    DisconnectNamedPipe(pipe);
+  }
+
+  CloseHandle(overlapped.hEvent);
+#else
+  int s = static_cast<int>(Endpoint);
+  while (false == Stopping)
+  {
+    // Wakes up periodically so Destroy() doesn't depend on closing the
+    // socket from another thread to break out of accept()
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(s, &readable);
+
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = STOP_CHECK_MS * 1000;
+
+    if (0 >= select(s + 1, &readable, nullptr, nullptr, &timeout))
+    {
+      continue;
+    }
+
+    int client = accept(s, nullptr, nullptr);
+    if (0 <= client)
+    {
+      Serve(client);
+      close(client);
+    }
+  }
+#endif
+}
+
+void LocalPipe::Serve(intptr_t client)
+{
+#ifdef _WIN32
+  HANDLE pipe = reinterpret_cast<HANDLE>(client);
+#else
+  int s = static_cast<int>(client);
+
+  // A client that stops sending can only hold the server this long
+  SetTimeout(s, CLIENT_TIMEOUT_MS);
+#endif
+
+  std::string request;
+  char buffer[512];
+  while (std::string::npos == request.find(Terminator))
+  {
+#ifdef _WIN32
+    DWORD n = 0;
+    if (false == ReadSome(pipe, buffer, sizeof(buffer), CLIENT_TIMEOUT_MS, n))
+    {
+      return;
+    }
+#else
+    ssize_t n = recv(s, buffer, sizeof(buffer), 0);
+#endif
+    if ((0 >= n) || (MAX_REQUEST_SIZE < request.size() + static_cast<size_t>(n)))
+    {
+      return;
+    }
+
+    request.append(buffer, static_cast<size_t>(n));
+  }
+
+#ifdef _WIN32
+  // Disconnecting discards anything the client hasn't read yet, so wait for
+  // it to drain the response first
+  if (true == SendAll(pipe, _RequestHandler(request, RequestContext), CLIENT_TIMEOUT_MS))
+  {
+    FlushFileBuffers(pipe);
+  }
+#else
+  SendAll(s, _RequestHandler(request, RequestContext));
+#endif
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Request/response server on a local IPC endpoint that only its owner can
+// open: a named pipe limited to SYSTEM, Administrators and the creating
+// user on Windows, a 0600 AF_UNIX socket elsewhere. Exchanges work as for
+// LocalServer, one request ending with Terminator and one response per
+// connection, served one at a time on the server's own thread.
+class LocalPipe
+{
+public:
+
+  typedef std::string(*RequestHandler)(const std::string& request, void* pContext);
+
+  static const size_t   MAX_REQUEST_SIZE = 4096;
+  static const uint32_t CLIENT_TIMEOUT_MS = 1000;
+  static const uint32_t STOP_CHECK_MS = 250;
+
+  // \\.\pipe\<name> on Windows, <name>.sock in $XDG_RUNTIME_DIR (or a
+  // per-user name in /tmp) elsewhere
+  static std::string DefaultPath(const std::string& name);
+
+  // Returns nullptr if the endpoint can't be created, or is already served
+  static LocalPipe* Create(const std::string& path,
+                           std::string terminator,
+                           RequestHandler handler,
+                           void* pContext);
+  static void Destroy(LocalPipe* instance);
+
+  // One request/response exchange as a client, false if nothing answered
+  static bool Send(const std::string& path, const std::string& request, std::string& response);
+
+private:
+
+  LocalPipe(const std::string& path, std::string terminator, RequestHandler handler, void* pContext);
+  ~LocalPipe();
+
+  bool Listen();
+  void ServeLoop();
+  void Serve(intptr_t client);
+
+  std::string Path;
+  std::string Terminator;
+  RequestHandler _RequestHandler;
+  void* RequestContext;
+  intptr_t Endpoint;
+  bool Owned;
+  std::atomic<bool> Stopping;
+  std::thread Worker;
+};
@@ -0,0 +1,237 @@
+#include "LocalServer.h"
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define CloseSocket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#define INVALID_SOCKET (-1)
+#define CloseSocket close
+#endif
+
+namespace
+{
+  bool StartSockets()
+  {
+#ifdef _WIN32
+    // Reference counted by Winsock, matched in StopSockets()
+    WSADATA data;
+    return 0 == WSAStartup(MAKEWORD(2, 2), &data);
+#else
+    return true;
+#endif
+  }
+
+  void StopSockets()
+  {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+  }
+
+  void SetTimeout(intptr_t s, uint32_t timeoutMs)
+  {
+#ifdef _WIN32
+    DWORD timeout = timeoutMs;
+#else
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+  }
+
+  sockaddr_in Loopback(uint16_t port)
+  {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+  }
+
+  bool SendAll(intptr_t s, const std::string& data)
+  {
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+      int n = send(s, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+      if (0 >= n)
+      {
+        return false;
+      }
+
+      sent += static_cast<size_t>(n);
+    }
+
+    return true;
+  }
+}
+
+LocalServer* LocalServer::Create(uint16_t port,
+                                 std::string terminator,
+                                 RequestHandler handler,
+                                 void* pContext)
+{
+  if (false == StartSockets())
+  {
+    return nullptr;
+  }
+
+  LocalServer* instance = new LocalServer(port, terminator, handler, pContext);
+  if (false == instance->Listen())
+  {
+    delete instance;
+    return nullptr;
+  }
+
+  instance->Worker = std::thread(&LocalServer::ServeLoop, instance);
+  return instance;
+}
+
+void LocalServer::Destroy(LocalServer* instance)
+{
+  delete instance;
+}
+
+bool LocalServer::Send(uint16_t port, const std::string& request, std::string& response)
+{
+  if (false == StartSockets())
+  {
+    return false;
+  }
+
+  bool success = false;
+  intptr_t s = static_cast<intptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+  if (INVALID_SOCKET != s)
+  {
+    SetTimeout(s, CLIENT_TIMEOUT_MS * 10);
+
+    sockaddr_in addr = Loopback(port);
+    if ((0 == connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) &&
+        (true == SendAll(s, request)))
+    {
+      // The server closes the connection once the response is written
+      response.clear();
+      char buffer[1024];
+      int n = 0;
+      while (0 < (n = recv(s, buffer, sizeof(buffer), 0)))
+      {
+        response.append(buffer, static_cast<size_t>(n));
+      }
+
+      success = (0 == n);
+    }
+
+    CloseSocket(s);
+  }
+
+  StopSockets();
+  return success;
+}
+
+LocalServer::LocalServer(uint16_t port, std::string terminator, RequestHandler handler, void* pContext) :
+  Port(port),
+  Terminator(terminator),
+  _RequestHandler(handler),
+  RequestContext(pContext),
+  ListenSocket(INVALID_SOCKET),
+  Stopping(false)
+{
+}
+
+LocalServer::~LocalServer()
+{
+  Stopping = true;
+  if (true == Worker.joinable())
+  {
+    Worker.join();
+  }
+
+  if (INVALID_SOCKET != ListenSocket)
+  {
+    CloseSocket(ListenSocket);
+  }
+
+  StopSockets();
+}
+
+bool LocalServer::Listen()
+{
+  ListenSocket = static_cast<intptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+  if (INVALID_SOCKET == ListenSocket)
+  {
+    return false;
+  }
+
+#ifndef _WIN32
+  // Lets a restarted process rebind while old connections sit in TIME_WAIT
+  int reuse = 1;
+  setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+#endif
+
+  sockaddr_in addr = Loopback(Port);
+  return (0 == bind(ListenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) &&
+         (0 == listen(ListenSocket, 4));
+}
+
+void LocalServer::ServeLoop()
+{
+  while (false == Stopping)
+  {
+    // Wakes up periodically so Destroy() doesn't depend on closing the
+    // socket from another thread to break out of accept()
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(ListenSocket, &readable);
+
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = STOP_CHECK_MS * 1000;
+
+    if (0 >= select(static_cast<int>(ListenSocket + 1), &readable, nullptr, nullptr, &timeout))
+    {
+      continue;
+    }
+
+    intptr_t client = static_cast<intptr_t>(accept(ListenSocket, nullptr, nullptr));
+    if (INVALID_SOCKET != client)
+    {
+      Serve(client);
+      CloseSocket(client);
+    }
+  }
+}
+
+void LocalServer::Serve(intptr_t client)
+{
+  // A client that stops sending can only hold the server this long
+  SetTimeout(client, CLIENT_TIMEOUT_MS);
+
+  std::string request;
+  char buffer[512];
+  while (std::string::npos == request.find(Terminator))
+  {
+    int n = recv(client, buffer, sizeof(buffer), 0);
+    if ((0 >= n) || (MAX_REQUEST_SIZE < request.size() + static_cast<size_t>(n)))
+    {
+      return;
+    }
+
+    request.append(buffer, static_cast<size_t>(n));
+  }
+
+  SendAll(client, _RequestHandler(request, RequestContext));
+}
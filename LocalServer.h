@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Small request/response server bound to the loopback interface. Each
+// connection sends one request, ending with Terminator, and gets one
+// response before the server closes it. Connections are served one at a
+// time on the server's own thread, so handlers never run on the caller's.
+class LocalServer
+{
+public:
+
+  typedef std::string(*RequestHandler)(const std::string& request, void* pContext);
+
+  static const size_t   MAX_REQUEST_SIZE = 4096;
+  static const uint32_t CLIENT_TIMEOUT_MS = 1000;
+  static const uint32_t STOP_CHECK_MS = 250;
+
+  // Returns nullptr if the port can't be bound
+  static LocalServer* Create(uint16_t port,
+                             std::string terminator,
+                             RequestHandler handler,
+                             void* pContext);
+  static void Destroy(LocalServer* instance);
+
+  // One request/response exchange as a client, false if nothing answered
+  static bool Send(uint16_t port, const std::string& request, std::string& response);
+
+private:
+
+  LocalServer(uint16_t port, std::string terminator, RequestHandler handler, void* pContext);
+  ~LocalServer();
+
+  bool Listen();
+  void ServeLoop();
+  void Serve(intptr_t client);
+
+  uint16_t Port;
+  std::string Terminator;
+  RequestHandler _RequestHandler;
+  void* RequestContext;
+  intptr_t ListenSocket;
+  std::atomic<bool> Stopping;
+  std::thread Worker;
+};
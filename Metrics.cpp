@@ -0,0 +1,257 @@
+#include "Metrics.h"
+#include "LocalServer.h"
+#include <cstdio>
+#include <cstring>
+
+const uint64_t Metrics::BUCKET_BOUNDS_US[BUCKET_COUNT - 1] =
+{
+  1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+  1000000, 2500000, 5000000, 10000000, 30000000
+};
+
+std::atomic<uint64_t> Metrics::Counters[COUNTER_COUNT];
+std::atomic<int64_t> Metrics::Gauges[GAUGE_COUNT];
+Metrics::Histogram Metrics::Histograms[HISTOGRAM_COUNT];
+
+std::mutex Metrics::ListenerLock;
+LocalServer* Metrics::Listener = nullptr;
+
+namespace
+{
+  // Consecutive entries with the same name are one labelled family
+  struct MetricInfo
+  {
+    const char* Name;
+    const char* Labels;
+    const char* Help;
+  };
+
+  const MetricInfo COUNTER_INFO[Metrics::COUNTER_COUNT] =
+  {
+    { "vbsc_ble_connects_total", "", "BLE connections established" },
+    { "vbsc_ble_connect_failures_total", "", "BLE connection attempts that did not connect" },
+    { "vbsc_ble_connect_exceptions_total", "", "Exceptions caught in LightHouse::Connect" },
+    { "vbsc_ble_connect_reuses_total", "", "Operations served by an already open connection" },
+    { "vbsc_ble_disconnects_total", "", "BLE connections closed" },
+    { "vbsc_ble_disconnect_exceptions_total", "", "Exceptions caught in LightHouse::Disconnect" },
+    { "vbsc_ble_reads_total", "", "Characteristic reads completed" },
+    { "vbsc_ble_read_failures_total", "", "Characteristic reads that threw" },
+    { "vbsc_ble_writes_total", "", "Characteristic writes completed" },
+    { "vbsc_ble_write_failures_total", "", "Characteristic writes that threw" },
+    { "vbsc_ble_notifications_total", "", "Power state notifications received" },
+    { "vbsc_ble_operation_failures_total", "", "Connected operations abandoned after an exception" },
+    { "vbsc_ble_discovery_failures_total", "", "Service discoveries that threw" },
+    { "vbsc_power_retries_total", "", "Power writes repeated because the verification read disagreed" },
+    { "vbsc_breaker_opens_total", "", "Stations marked unreachable after repeated connection failures" },
+    { "vbsc_probes_total", "", "Reconnection attempts made to unreachable stations" },
+    { "vbsc_state_transitions_total", "to=\"idle\"", "Scan loop state transitions by target state" },
+    { "vbsc_state_transitions_total", "to=\"scan\"", "" },
+    { "vbsc_state_transitions_total", "to=\"processing\"", "" },
+    { "vbsc_state_transitions_total", "to=\"terminating\"", "" },
+    { "vbsc_state_transitions_total", "to=\"powering_on\"", "" },
+    { "vbsc_poll_ticks_total", "", "Processing ticks that polled the stations" },
+    { "vbsc_poll_ticks_vr_skipped_total", "", "Processing ticks skipped while VR was active" },
+    { "vbsc_auto_shutoffs_total", "", "Automatic power off after the VR session ended" },
+    { "vbsc_pre_wakes_total", "", "Power on started by SteamVR's launcher or server appearing" },
+    { "vbsc_commands_total", "result=\"queued\"", "User commands by outcome" },
+    { "vbsc_commands_total", "result=\"collapsed\"", "" },
+    { "vbsc_commands_total", "result=\"rejected\"", "" }
+  };
+
+  const MetricInfo GAUGE_INFO[Metrics::GAUGE_COUNT] =
+  {
+    { "vbsc_stations", "", "Lighthouses currently known" },
+    { "vbsc_subscribed_stations", "", "Lighthouses pushing power state notifications" },
+    { "vbsc_unreachable_stations", "", "Lighthouses waiting out a connection backoff" }
+  };
+
+  const MetricInfo HISTOGRAM_INFO[Metrics::HISTOGRAM_COUNT] =
+  {
+    { "vbsc_ble_connect_seconds", "", "Time to establish a BLE connection" },
+    { "vbsc_ble_read_seconds", "", "Characteristic read latency" },
+    { "vbsc_ble_write_seconds", "", "Characteristic write latency" },
+    { "vbsc_discovery_seconds", "", "Duration of a discovery scan" },
+    { "vbsc_poll_seconds", "", "Duration of a poll pass over all stations" },
+    { "vbsc_power_on_seconds", "", "Duration of a power on command" },
+    { "vbsc_power_off_seconds", "", "Duration of a power off command" },
+    { "vbsc_time_to_ready_seconds", "from=\"sleep\"", "Time from the wake write to the station tracking" },
+    { "vbsc_time_to_ready_seconds", "from=\"standby\"", "" },
+    { "vbsc_pre_wake_saved_seconds", "", "How much sooner a pre-wake had the stations tracking" }
+  };
+
+  void AppendHeader(std::string& out, const MetricInfo& info, const char* type)
+  {
+    out += "# HELP ";
+    out += info.Name;
+    out += " ";
+    out += info.Help;
+    out += "\n# TYPE ";
+    out += info.Name;
+    out += " ";
+    out += type;
+    out += "\n";
+  }
+
+  void AppendSample(std::string& out, const char* name, const char* suffix,
+                    const char* labels, const char* value)
+  {
+    out += name;
+    out += suffix;
+    if ('\0' != labels[0])
+    {
+      out += "{";
+      out += labels;
+      out += "}";
+    }
+
+    out += " ";
+    out += value;
+    out += "\n";
+  }
+
+  void AppendHttp(std::string& out, const char* status, const std::string& body)
+  {
+    char header[192];
+    snprintf(header, sizeof(header),
+             "HTTP/1.1 %s\r\n"
+             "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+             "Content-Length: %u\r\n"
+             "Connection: close\r\n\r\n",
+             status, static_cast<unsigned>(body.size()));
+    out += header;
+    out += body;
+  }
+}
+
+
+void Metrics::Increment(CounterEnum counter, uint64_t amount)
+{
+  Counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void Metrics::Set(GaugeEnum gauge, int64_t value)
+{
+  Gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+void Metrics::Observe(HistogramEnum histogram, std::chrono::steady_clock::duration elapsed)
+{
+  uint64_t us = static_cast<uint64_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+  size_t bucket = 0;
+  while ((BUCKET_COUNT - 1 > bucket) && (BUCKET_BOUNDS_US[bucket] < us))
+  {
+    ++bucket;
+  }
+
+  Histogram& h = Histograms[histogram];
+  h.Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  h.SumUs.fetch_add(us, std::memory_order_relaxed);
+}
+
+std::string Metrics::Format()
+{
+  std::string out;
+  out.reserve(8192);
+
+  char value[64];
+  for (size_t i = 0; i < COUNTER_COUNT; ++i)
+  {
+    if ((0 == i) || (0 != strcmp(COUNTER_INFO[i - 1].Name, COUNTER_INFO[i].Name)))
+    {
+      AppendHeader(out, COUNTER_INFO[i], "counter");
+    }
+
+    snprintf(value, sizeof(value), "%llu",
+             static_cast<unsigned long long>(Counters[i].load(std::memory_order_relaxed)));
+    AppendSample(out, COUNTER_INFO[i].Name, "", COUNTER_INFO[i].Labels, value);
+  }
+
+  for (size_t i = 0; i < GAUGE_COUNT; ++i)
+  {
+    AppendHeader(out, GAUGE_INFO[i], "gauge");
+    snprintf(value, sizeof(value), "%lld",
+             static_cast<long long>(Gauges[i].load(std::memory_order_relaxed)));
+    AppendSample(out, GAUGE_INFO[i].Name, "", "", value);
+  }
+
+  for (size_t i = 0; i < HISTOGRAM_COUNT; ++i)
+  {
+    if ((0 == i) || (0 != strcmp(HISTOGRAM_INFO[i - 1].Name, HISTOGRAM_INFO[i].Name)))
+    {
+      AppendHeader(out, HISTOGRAM_INFO[i], "histogram");
+    }
+
+    // The family's labels go ahead of le on every bucket
+    std::string prefix = HISTOGRAM_INFO[i].Labels;
+    if (false == prefix.empty())
+    {
+      prefix += ",";
+    }
+
+    // Read without a lock, a scrape racing Observe() may see the bucket
+    // before the sum. The count is the bucket total so the two always agree.
+    Histogram& h = Histograms[i];
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b < BUCKET_COUNT; ++b)
+    {
+      cumulative += h.Buckets[b].load(std::memory_order_relaxed);
+
+      char labels[64];
+      if (BUCKET_COUNT - 1 > b)
+      {
+        snprintf(labels, sizeof(labels), "%sle=\"%g\"", prefix.c_str(), BUCKET_BOUNDS_US[b] / 1e6);
+      }
+      else
+      {
+        snprintf(labels, sizeof(labels), "%sle=\"+Inf\"", prefix.c_str());
+      }
+
+      snprintf(value, sizeof(value), "%llu", static_cast<unsigned long long>(cumulative));
+      AppendSample(out, HISTOGRAM_INFO[i].Name, "_bucket", labels, value);
+    }
+
+    snprintf(value, sizeof(value), "%.6f", h.SumUs.load(std::memory_order_relaxed) / 1e6);
+    AppendSample(out, HISTOGRAM_INFO[i].Name, "_sum", HISTOGRAM_INFO[i].Labels, value);
+    snprintf(value, sizeof(value), "%llu", static_cast<unsigned long long>(cumulative));
+    AppendSample(out, HISTOGRAM_INFO[i].Name, "_count", HISTOGRAM_INFO[i].Labels, value);
+  }
+
+  return out;
+}
+
+bool Metrics::StartListener(uint16_t port)
+{
+  std::lock_guard<std::mutex> lock(ListenerLock);
+  if (nullptr != Listener)
+  {
+    return false;
+  }
+
+  Listener = LocalServer::Create(port, "\r\n\r\n", &Metrics::HandleRequest, nullptr);
+  return nullptr != Listener;
+}
+
+void Metrics::StopListener()
+{
+  std::lock_guard<std::mutex> lock(ListenerLock);
+  LocalServer::Destroy(Listener);
+  Listener = nullptr;
+}
+
+std::string Metrics::HandleRequest(const std::string& request, void* /* pContext */)
+{
+  std::string response;
+  if ((0 == request.compare(0, 13, "GET /metrics ")) ||
+      (0 == request.compare(0, 6, "GET / ")))
+  {
+    AppendHttp(response, "200 OK", Format());
+  }
+  else
+  {
+    AppendHttp(response, "404 Not Found", "Not found\n");
+  }
+
+  return response;
+}
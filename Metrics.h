@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+class LocalServer;
+
+// Process wide counters, gauges and latency histograms. Updates are relaxed
+// atomic adds, so instrumented code never waits on a scrape, and Format()
+// only reads them. StartListener() serves the Prometheus text format on
+// http://127.0.0.1:<port>/metrics from the listener's own thread.
+class Metrics
+{
+public:
+
+  enum CounterEnum
+  {
+    CONNECTS,
+    CONNECT_FAILURES,
+    CONNECT_EXCEPTIONS,
+    CONNECT_REUSES,
+    DISCONNECTS,
+    DISCONNECT_EXCEPTIONS,
+    READS,
+    READ_FAILURES,
+    WRITES,
+    WRITE_FAILURES,
+    NOTIFICATIONS,
+    OPERATION_FAILURES,
+    DISCOVERY_FAILURES,
+    POWER_RETRIES,
+    BREAKER_OPENS,
+    PROBES,
+    TRANSITIONS_IDLE,
+    TRANSITIONS_SCAN,
+    TRANSITIONS_PROCESSING,
+    TRANSITIONS_TERMINATING,
+    TRANSITIONS_POWERING_ON,
+    POLL_TICKS,
+    POLL_TICKS_VR_SKIPPED,
+    AUTO_SHUTOFFS,
+    PRE_WAKES,
+    COMMANDS_QUEUED,
+    COMMANDS_COLLAPSED,
+    COMMANDS_REJECTED,
+    COUNTER_COUNT
+  };
+
+  enum GaugeEnum
+  {
+    STATIONS,
+    SUBSCRIBED_STATIONS,
+    UNREACHABLE_STATIONS,
+    GAUGE_COUNT
+  };
+
+  enum HistogramEnum
+  {
+    CONNECT_LATENCY,
+    READ_LATENCY,
+    WRITE_LATENCY,
+    DISCOVERY_DURATION,
+    POLL_DURATION,
+    POWER_ON_DURATION,
+    POWER_OFF_DURATION,
+    READY_FROM_SLEEP,
+    READY_FROM_STANDBY,
+    PRE_WAKE_SAVED,
+    HISTOGRAM_COUNT
+  };
+
+  // Upper bounds of the histogram buckets, the last one is +Inf
+  static const size_t BUCKET_COUNT = 14;
+  static const uint64_t BUCKET_BOUNDS_US[BUCKET_COUNT - 1];
+
+  static void Increment(CounterEnum counter, uint64_t amount = 1);
+  static void Set(GaugeEnum gauge, int64_t value);
+  static void Observe(HistogramEnum histogram, std::chrono::steady_clock::duration elapsed);
+
+  // Prometheus text exposition format, version 0.0.4
+  static std::string Format();
+
+  static bool StartListener(uint16_t port);
+  static void StopListener();
+
+private:
+
+  struct Histogram
+  {
+    std::atomic<uint64_t> Buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> SumUs;
+  };
+
+  static std::string HandleRequest(const std::string& request, void* pContext);
+
+  static std::atomic<uint64_t> Counters[COUNTER_COUNT];
+  static std::atomic<int64_t> Gauges[GAUGE_COUNT];
+  static Histogram Histograms[HISTOGRAM_COUNT];
+
+  static std::mutex ListenerLock;
+  static LocalServer* Listener;
+};
@@ -0,0 +1,763 @@
+#include "SimBLEBackend.h"
+#include "LightHouse.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+
+const char* SimBLEBackend::DEVICE_INFO_SVC_UUID   = "0000180a-0000-1000-8000-00805f9b34fb";
+const char* SimBLEBackend::MANUFACTURER_CHAR_UUID = "00002a29-0000-1000-8000-00805f9b34fb";
+const char* SimBLEBackend::FIRMWARE_CHAR_UUID     = "00002a26-0000-1000-8000-00805f9b34fb";
+const char* SimBLEBackend::IDENTIFY_CHAR_UUID     = "00008421-1212-efde-1523-785feabcd124";
+
+namespace
+{
+
+// The simulated stack speaks text, like the real one
+const std::string PWR_SVC_TEXT = LightHouse::PWR_SVC_UUID.ToString();
+const std::string PWR_CHAR_TEXT = LightHouse::PWR_CHAR_UUID.ToString();
+
+}
+
+// State of one simulated device, shared by the peripherals every adapter
+// hands out for it. Operations sleep for their sampled latency without
+// holding the lock, so concurrent connections overlap like on real links.
+class SimBLEBackend::SimStation : public std::enable_shared_from_this<SimStation>
+{
+public:
+
+  SimStation(SimBLEBackend* backend, size_t index, bool lighthouse) :
+    Backend(backend),
+    Profile(backend->Config.Profile),
+    Rng(backend->Config.Seed * 7919u + static_cast<uint32_t>(index)),
+    Index(index),
+    Connected(false),
+    Reachable(true),
+    PowerState(backend->Config.Profile.InitialPowerState),
+    PowerGeneration(0)
+  {
+    char text[32];
+    snprintf(text, sizeof(text), "C0:DE:00:00:%02X:%02X",
+             static_cast<unsigned>((index >> 8) & 0xff), static_cast<unsigned>(index & 0xff));
+    Address = text;
+
+    if (true == lighthouse)
+    {
+      snprintf(text, sizeof(text), "%s%08X", LightHouse::LIGHTHOUSE_ID,
+               static_cast<unsigned>(0x5A1E0000u + index));
+      Identifier = text;
+
+      Values[std::make_pair(PWR_SVC_TEXT, IDENTIFY_CHAR_UUID)] = std::string(1, '\0');
+      Values[std::make_pair(PWR_SVC_TEXT, PWR_CHAR_TEXT)] = "";
+    }
+    else
+    {
+      snprintf(text, sizeof(text), "Sim-%04X", static_cast<unsigned>(index));
+      Identifier = text;
+    }
+
+    Values[std::make_pair(DEVICE_INFO_SVC_UUID, MANUFACTURER_CHAR_UUID)] = "Valve Corporation";
+    Values[std::make_pair(DEVICE_INFO_SVC_UUID, FIRMWARE_CHAR_UUID)] = "1.14.6";
+  }
+
+  std::string GetIdentifier() const
+  {
+    return Identifier;
+  }
+
+  std::string GetAddress() const
+  {
+    return Address;
+  }
+
+  size_t GetIndex() const
+  {
+    return Index;
+  }
+
+  bool IsConnected()
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    return Connected;
+  }
+
+  std::chrono::microseconds SampleAdvertise()
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    return Sample(Profile.Advertise);
+  }
+
+  void Connect()
+  {
+    std::chrono::microseconds latency;
+    bool fail = false;
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      if (true == Connected)
+      {
+        return;
+      }
+
+      latency = (true == Reachable) ? Sample(Profile.Connect) : 
+                                      std::chrono::microseconds(Profile.ConnectTimeout);
+      fail = (false == Reachable) || Chance(Profile.ConnectFailureRate);
+    }
+
+    Backend->Delay(latency);
+    if (true == fail)
+    {
+      throw std::runtime_error("Connection failed");
+    }
+
+    std::lock_guard<std::mutex> lock(Lock);
+    Connected = true;
+  }
+
+  void Disconnect()
+  {
+    DropLink();
+  }
+
+  bool IsReachable()
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    return Reachable;
+  }
+
+  void SetReachable(bool reachable)
+  {
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      Reachable = reachable;
+    }
+
+    if (false == reachable)
+    {
+      DropLink();
+    }
+  }
+
+  std::vector<std::pair<std::string, std::string>> GetCharacteristics()
+  {
+    // Service discovery costs about one read round trip per service
+    std::chrono::microseconds latency;
+    std::vector<std::pair<std::string, std::string>> characteristics;
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      if (false == Connected)
+      {
+        throw std::runtime_error("Not connected");
+      }
+
+      latency = Sample(Profile.Read) * 2;
+      for (ValueMap::const_iterator itr = Values.begin(); itr != Values.end(); ++itr)
+      {
+        characteristics.push_back(itr->first);
+      }
+    }
+
+    Backend->Delay(latency);
+
+    return characteristics;
+  }
+
+  std::string Read(const std::string& service, const std::string& characteristic)
+  {
+    BeginOperation(Profile.Read, Profile.ReadFailureRate, "Read failed", true);
+
+    std::lock_guard<std::mutex> lock(Lock);
+    ValueMap::const_iterator itr = Values.find(std::make_pair(service, characteristic));
+    if (Values.end() == itr)
+    {
+      throw std::runtime_error("Unknown characteristic");
+    }
+
+    if (true == IsPowerCharacteristic(service, characteristic))
+    {
+      return std::string(1, static_cast<char>(PowerState));
+    }
+
+    return itr->second;
+  }
+
+  void Write(const std::string& service,
+             const std::string& characteristic,
+             const std::string& value,
+             bool request)
+  {
+    // A command isn't acknowledged, so a lost one goes unnoticed
+    if (false == BeginOperation(Profile.Write, Profile.WriteFailureRate, "Write failed", request))
+    {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      ValueMap::iterator itr = Values.find(std::make_pair(service, characteristic));
+      if (Values.end() == itr)
+      {
+        throw std::runtime_error("Unknown characteristic");
+      }
+
+      if ((false == IsPowerCharacteristic(service, characteristic)) || (true == value.empty()))
+      {
+        itr->second = value;
+        return;
+      }
+    }
+
+    SetPowerState(static_cast<uint8_t>(value[0]));
+  }
+
+  void Subscribe(const std::string& service,
+                 const std::string& characteristic,
+                 BLEPeripheral::PayloadCallback cb)
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    if (false == Connected)
+    {
+      throw std::runtime_error("Not connected");
+    }
+
+    if ((false == Profile.CanNotify) || (false == IsPowerCharacteristic(service, characteristic)))
+    {
+      throw std::runtime_error("Characteristic can't notify");
+    }
+
+    Subscriber = cb;
+  }
+
+  void Unsubscribe()
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    Subscriber = nullptr;
+  }
+
+  void SetDisconnectedCallback(std::function<void()> cb)
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    DisconnectedCallback = cb;
+  }
+
+  uint8_t GetPowerState()
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    return PowerState;
+  }
+
+  // Applies a power write. Waking up goes through the boot states on the
+  // backend's event thread, a later write cancels a boot in progress.
+  void SetPowerState(uint8_t state)
+  {
+    uint32_t generation = 0;
+    uint8_t previous = PWR_SLEEP;
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      generation = ++PowerGeneration;
+      previous = PowerState;
+    }
+
+    Transition(generation, state);
+
+    if (PWR_WAKING == state)
+    {
+      std::weak_ptr<SimStation> self = shared_from_this();
+      std::chrono::microseconds bootTime = (PWR_STANDBY == previous) ? Profile.StandbyWakeTime : 
+                                                                       Profile.BootTime;
+
+      Backend->Schedule(bootTime / 2, [self, generation]()
+      {
+        std::shared_ptr<SimStation> station = self.lock();
+        if (nullptr != station)
+        {
+          station->Transition(generation, PWR_BOOTING);
+        }
+      });
+
+      Backend->Schedule(bootTime, [self, generation]()
+      {
+        std::shared_ptr<SimStation> station = self.lock();
+        if (nullptr != station)
+        {
+          station->Transition(generation, PWR_ON);
+        }
+      });
+    }
+  }
+
+private:
+
+  typedef std::map<std::pair<std::string, std::string>, std::string> ValueMap;
+
+  static bool IsPowerCharacteristic(const std::string& service, const std::string& characteristic)
+  {
+    return (PWR_SVC_TEXT == service) && (PWR_CHAR_TEXT == characteristic);
+  }
+
+  // Returns false if an unacknowledged operation was lost, throws if an
+  // acknowledged one failed.
+  bool BeginOperation(const LatencyModel& model, double failureRate, const char* error, bool acknowledged)
+  {
+    std::chrono::microseconds latency;
+    bool fail = false;
+    bool drop = false;
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      if (false == Connected)
+      {
+        throw std::runtime_error("Not connected");
+      }
+
+      latency = Sample(model);
+      fail = Chance(failureRate);
+      drop = Chance(Profile.LinkDropRate);
+    }
+
+    Backend->Delay((true == acknowledged) ? latency : latency / 2);
+
+    if (true == drop)
+    {
+      DropLink();
+      throw std::runtime_error("Link lost");
+    }
+
+    if ((true == fail) && (true == acknowledged))
+    {
+      throw std::runtime_error(error);
+    }
+
+    return (false == fail);
+  }
+
+  void Transition(uint32_t generation, uint8_t state)
+  {
+    BLEPeripheral::PayloadCallback cb;
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      if ((generation != PowerGeneration) || (state == PowerState))
+      {
+        return;
+      }
+
+      PowerState = state;
+      if (true == Connected)
+      {
+        cb = Subscriber;
+      }
+    }
+
+    if (nullptr != cb)
+    {
+      cb(std::string(1, static_cast<char>(state)));
+    }
+  }
+
+  void DropLink()
+  {
+    std::function<void()> cb;
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      if (false == Connected)
+      {
+        return;
+      }
+
+      Connected = false;
+      Subscriber = nullptr;
+      cb = DisconnectedCallback;
+    }
+
+    if (nullptr != cb)
+    {
+      cb();
+    }
+  }
+
+  std::chrono::microseconds Sample(const LatencyModel& model)
+  {
+    double us = static_cast<double>(model.Mean.count());
+    double spread = static_cast<double>(model.Spread.count());
+
+    if (0 < spread)
+    {
+      switch (model.Shape)
+      {
+      case LatencyModel::UNIFORM:
+        us += std::uniform_real_distribution<double>(-spread, spread)(Rng);
+        break;
+      case LatencyModel::NORMAL:
+        us = std::normal_distribution<double>(us, spread)(Rng);
+        break;
+      default:
+        break;
+      }
+    }
+
+    return std::chrono::microseconds(static_cast<int64_t>(std::max(0.0, us)));
+  }
+
+  bool Chance(double rate)
+  {
+    return (0 < rate) && (std::uniform_real_distribution<double>(0.0, 1.0)(Rng) < rate);
+  }
+
+  SimBLEBackend* Backend;
+  const StationProfile Profile;
+  std::mt19937 Rng;
+  size_t Index;
+  std::string Address;
+  std::string Identifier;
+
+  std::mutex Lock;
+  bool Connected;
+  bool Reachable;
+  uint8_t PowerState;
+  uint32_t PowerGeneration;
+  ValueMap Values;
+  BLEPeripheral::PayloadCallback Subscriber;
+  std::function<void()> DisconnectedCallback;
+};
+
+// One adapter's view of a station, the RSSI differs between adapters. Like
+// SimpleBLE's peripheral copies, every view shares the station's callbacks.
+class SimPeripheral : public BLEPeripheral
+{
+public:
+
+  SimPeripheral(std::shared_ptr<SimBLEBackend::SimStation> station, int16_t rssi) :
+    Station(station),
+    Rssi(rssi)
+  {
+  }
+
+  std::string GetIdentifier()
+  {
+    return Station->GetIdentifier();
+  }
+
+  std::string GetAddress()
+  {
+    return Station->GetAddress();
+  }
+
+  int16_t GetRssi()
+  {
+    return Rssi;
+  }
+
+  bool IsConnected()
+  {
+    return Station->IsConnected();
+  }
+
+  void Connect()
+  {
+    Station->Connect();
+  }
+
+  void Disconnect()
+  {
+    Station->Disconnect();
+  }
+
+  std::vector<std::pair<std::string, std::string>> GetCharacteristics()
+  {
+    return Station->GetCharacteristics();
+  }
+
+  std::string Read(const std::string& service, const std::string& characteristic)
+  {
+    return Station->Read(service, characteristic);
+  }
+
+  void WriteRequest(const std::string& service,
+                    const std::string& characteristic,
+                    const std::string& value)
+  {
+    Station->Write(service, characteristic, value, true);
+  }
+
+  void WriteCommand(const std::string& service,
+                    const std::string& characteristic,
+                    const std::string& value)
+  {
+    Station->Write(service, characteristic, value, false);
+  }
+
+  void Notify(const std::string& service,
+              const std::string& characteristic,
+              PayloadCallback cb)
+  {
+    Station->Subscribe(service, characteristic, cb);
+  }
+
+  void Indicate(const std::string& service,
+                const std::string& characteristic,
+                PayloadCallback cb)
+  {
+    Station->Subscribe(service, characteristic, cb);
+  }
+
+  void Unsubscribe(const std::string& /* service */, const std::string& /* characteristic */)
+  {
+    Station->Unsubscribe();
+  }
+
+  void SetDisconnectedCallback(std::function<void()> cb)
+  {
+    Station->SetDisconnectedCallback(cb);
+  }
+
+private:
+
+  std::shared_ptr<SimBLEBackend::SimStation> Station;
+  int16_t Rssi;
+};
+
+// Reports every station once per scan, after its sampled advertising delay
+class SimBLEBackend::SimAdapter : public BLEAdapter
+{
+public:
+
+  SimAdapter(SimBLEBackend* backend, size_t index) :
+    Backend(backend),
+    Index(index),
+    Scanning(false)
+  {
+  }
+
+  ~SimAdapter()
+  {
+    ScanStop();
+  }
+
+  std::string GetIdentifier()
+  {
+    return "sim" + std::to_string(Index);
+  }
+
+  void SetScanFoundCallback(ScanCallback cb)
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    Callback = cb;
+  }
+
+  void ScanStart()
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    if (true == Scanning)
+    {
+      return;
+    }
+
+    Scanning = true;
+    Worker = std::thread(&SimAdapter::Run, this);
+  }
+
+  void ScanStop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      Scanning = false;
+    }
+
+    StopSignal.notify_all();
+    if (true == Worker.joinable())
+    {
+      Worker.join();
+    }
+  }
+
+private:
+
+  void Run()
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::pair<std::chrono::microseconds, size_t>> schedule;
+    for (size_t i = 0; i < Backend->Stations.size(); ++i)
+    {
+      schedule.push_back(std::make_pair(Backend->Stations[i]->SampleAdvertise(), i));
+    }
+    std::sort(schedule.begin(), schedule.end());
+
+    for (size_t i = 0; i < schedule.size(); ++i)
+    {
+      ScanCallback cb;
+      {
+        std::unique_lock<std::mutex> lock(Lock);
+        std::chrono::steady_clock::time_point due = start +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(Backend->Scale(schedule[i].first));
+        if (true == StopSignal.wait_until(lock, due, [this]() { return false == Scanning; }))
+        {
+          return;
+        }
+
+        cb = Callback;
+      }
+
+      size_t station = schedule[i].second;
+      if ((nullptr != cb) && (true == Backend->Stations[station]->IsReachable()))
+      {
+        int16_t rssi = static_cast<int16_t>(-45 - static_cast<int>((station * 17 + Index * 29) % 40));
+        cb(std::make_shared<SimPeripheral>(Backend->Stations[station], rssi));
+      }
+    }
+  }
+
+  SimBLEBackend* Backend;
+  size_t Index;
+  std::mutex Lock;
+  std::condition_variable StopSignal;
+  ScanCallback Callback;
+  bool Scanning;
+  std::thread Worker;
+};
+
+
+SimBLEBackend::FleetConfig SimBLEBackend::DefaultConfig(size_t stations)
+{
+  FleetConfig config;
+  config.Stations = stations;
+  config.OtherDevices = stations;
+  config.Adapters = 1;
+  config.Seed = 1;
+  config.TimeScale = 1.0;
+
+  StationProfile& profile = config.Profile;
+  profile.Advertise = { LatencyModel::UNIFORM, std::chrono::milliseconds(1500), std::chrono::milliseconds(1000) };
+  profile.Connect = { LatencyModel::NORMAL, std::chrono::milliseconds(900), std::chrono::milliseconds(300) };
+  profile.Read = { LatencyModel::NORMAL, std::chrono::milliseconds(60), std::chrono::milliseconds(20) };
+  profile.Write = { LatencyModel::NORMAL, std::chrono::milliseconds(80), std::chrono::milliseconds(25) };
+  profile.ConnectFailureRate = 0.02;
+  profile.ReadFailureRate = 0.01;
+  profile.WriteFailureRate = 0.01;
+  profile.LinkDropRate = 0.005;
+  profile.ConnectTimeout = std::chrono::milliseconds(5000);
+  profile.BootTime = std::chrono::milliseconds(5000);
+  profile.StandbyWakeTime = std::chrono::milliseconds(1500);
+  profile.InitialPowerState = PWR_SLEEP;
+  profile.CanNotify = true;
+
+  return config;
+}
+
+SimBLEBackend::SimBLEBackend(const FleetConfig& config) :
+  Config(config),
+  Stopping(false)
+{
+  for (size_t i = 0; i < Config.Stations + Config.OtherDevices; ++i)
+  {
+    Stations.push_back(std::make_shared<SimStation>(this, i, i < Config.Stations));
+  }
+
+  for (size_t i = 0; i < Config.Adapters; ++i)
+  {
+    Adapters.push_back(std::make_shared<SimAdapter>(this, i));
+  }
+
+  EventThread = std::thread(&SimBLEBackend::EventLoop, this);
+}
+
+SimBLEBackend::~SimBLEBackend()
+{
+  Adapters.clear();
+
+  {
+    std::lock_guard<std::mutex> lock(EventLock);
+    Stopping = true;
+  }
+
+  EventSignal.notify_all();
+  EventThread.join();
+}
+
+bool SimBLEBackend::IsBluetoothEnabled()
+{
+  return true;
+}
+
+std::vector<std::shared_ptr<BLEAdapter>> SimBLEBackend::GetAdapters()
+{
+  return Adapters;
+}
+
+size_t SimBLEBackend::GetStationCount() const
+{
+  return Config.Stations;
+}
+
+std::string SimBLEBackend::GetStationAddress(size_t station) const
+{
+  return Stations[station]->GetAddress();
+}
+
+uint8_t SimBLEBackend::GetPowerState(size_t station) const
+{
+  return Stations[station]->GetPowerState();
+}
+
+void SimBLEBackend::SetPowerState(size_t station, uint8_t state)
+{
+  Stations[station]->SetPowerState(state);
+}
+
+void SimBLEBackend::SetReachable(size_t station, bool reachable)
+{
+  Stations[station]->SetReachable(reachable);
+}
+
+void SimBLEBackend::DropLink(size_t station)
+{
+  Stations[station]->Disconnect();
+}
+
+std::chrono::duration<double, std::micro> SimBLEBackend::Scale(std::chrono::microseconds latency) const
+{
+  return std::chrono::duration<double, std::micro>(static_cast<double>(latency.count()) * Config.TimeScale);
+}
+
+void SimBLEBackend::Delay(std::chrono::microseconds latency) const
+{
+  std::this_thread::sleep_for(Scale(latency));
+}
+
+void SimBLEBackend::Schedule(std::chrono::microseconds delay, std::function<void()> event)
+{
+  std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(Scale(delay));
+
+  {
+    std::lock_guard<std::mutex> lock(EventLock);
+    Events.insert(std::make_pair(due, event));
+  }
+
+  EventSignal.notify_all();
+}
+
+void SimBLEBackend::EventLoop()
+{
+  std::unique_lock<std::mutex> lock(EventLock);
+  while (false == Stopping)
+  {
+    if (true == Events.empty())
+    {
+      EventSignal.wait(lock);
+      continue;
+    }
+
+    std::chrono::steady_clock::time_point due = Events.begin()->first;
+    if (std::chrono::steady_clock::now() < due)
+    {
+      EventSignal.wait_until(lock, due);
+      continue;
+    }
+
+    std::function<void()> event = Events.begin()->second;
+    Events.erase(Events.begin());
+
+    lock.unlock();
+    event();
+    lock.lock();
+  }
+}
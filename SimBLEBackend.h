@@ -0,0 +1,116 @@
+#pragma once
+#include "BLEBackend.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// Simulated fleet of LHv2 base stations for running without Bluetooth.
+// Every station draws its latencies and failures from its own generator
+// seeded from FleetConfig::Seed, so a run with the same config and the same
+// per-station call sequence behaves the same every time.
+class SimBLEBackend : public BLEBackend
+{
+public:
+
+  // FIXED: always Mean. UNIFORM: Mean +/- Spread. NORMAL: Spread is the
+  // standard deviation, clamped at zero.
+  struct LatencyModel
+  {
+    enum ShapeEnum
+    {
+      FIXED,
+      UNIFORM,
+      NORMAL
+    };
+
+    ShapeEnum Shape;
+    std::chrono::microseconds Mean;
+    std::chrono::microseconds Spread;
+  };
+
+  struct StationProfile
+  {
+    LatencyModel Advertise;   // Scan start until the station is reported
+    LatencyModel Connect;
+    LatencyModel Read;
+    LatencyModel Write;       // Write with response, a command takes half
+    double ConnectFailureRate;
+    double ReadFailureRate;
+    double WriteFailureRate;  // Commands fail silently, requests throw
+    double LinkDropRate;      // Chance any operation loses the link
+    std::chrono::milliseconds ConnectTimeout;  // Connecting to an unreachable station
+    std::chrono::milliseconds BootTime;
+    std::chrono::milliseconds StandbyWakeTime;  // Boot time when woken from standby
+    uint8_t InitialPowerState;
+    bool CanNotify;
+  };
+
+  struct FleetConfig
+  {
+    size_t Stations;
+    size_t OtherDevices;      // Non-lighthouse advertisers the scan filters out
+    size_t Adapters;
+    uint32_t Seed;
+    double TimeScale;         // 0.1 runs ten times faster than real time
+    StationProfile Profile;
+  };
+
+  // Values of the power characteristic. Writing PWR_WAKING boots the
+  // station through PWR_BOOTING to PWR_ON over BootTime, or StandbyWakeTime
+  // when it was in standby.
+  static const uint8_t PWR_SLEEP   = 0x00;
+  static const uint8_t PWR_WAKING  = 0x01;
+  static const uint8_t PWR_STANDBY = 0x02;
+  static const uint8_t PWR_BOOTING = 0x09;
+  static const uint8_t PWR_ON      = 0x0b;
+
+  static const char* DEVICE_INFO_SVC_UUID;
+  static const char* MANUFACTURER_CHAR_UUID;
+  static const char* FIRMWARE_CHAR_UUID;
+  static const char* IDENTIFY_CHAR_UUID;
+
+  // Timings roughly as measured against real stations
+  static FleetConfig DefaultConfig(size_t stations);
+
+  SimBLEBackend(const FleetConfig& config);
+  ~SimBLEBackend();
+
+  bool IsBluetoothEnabled();
+  std::vector<std::shared_ptr<BLEAdapter>> GetAdapters();
+
+  // Inspection for benchmarks
+  size_t GetStationCount() const;
+  std::string GetStationAddress(size_t station) const;
+  uint8_t GetPowerState(size_t station) const;
+  void SetPowerState(size_t station, uint8_t state);
+  // An unreachable station stops advertising and its connects time out
+  void SetReachable(size_t station, bool reachable);
+  // The station loses its link, every view of it gets the disconnect
+  void DropLink(size_t station);
+
+  class SimStation;
+
+private:
+
+  class SimAdapter;
+
+  std::chrono::duration<double, std::micro> Scale(std::chrono::microseconds latency) const;
+  void Delay(std::chrono::microseconds latency) const;
+  void Schedule(std::chrono::microseconds delay, std::function<void()> event);
+  void EventLoop();
+
+  FleetConfig Config;
+  std::vector<std::shared_ptr<SimStation>> Stations;
+  std::vector<std::shared_ptr<BLEAdapter>> Adapters;
+
+  std::mutex EventLock;
+  std::condition_variable EventSignal;
+  std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> Events;
+  bool Stopping;
+  std::thread EventThread;
+};
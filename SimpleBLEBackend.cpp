@@ -0,0 +1,180 @@
+#include "SimpleBLEBackend.h"
+#include <simpleble/SimpleBLE.h>
+
+// SimpleBLE objects are handles to the stack's own device, so copies held
+// here stay valid for as long as the wrapper lives. Copies also share the
+// device's callbacks: a scan reports every sighting in a new wrapper, and
+// none of them may touch the disconnect callback LightHouse installed.
+class SimpleBLEPeripheral : public BLEPeripheral
+{
+public:
+
+  SimpleBLEPeripheral(SimpleBLE::Peripheral peripheral) :
+    Peripheral(peripheral)
+  {
+  }
+
+  std::string GetIdentifier()
+  {
+    return Peripheral.identifier();
+  }
+
+  std::string GetAddress()
+  {
+    return Peripheral.address();
+  }
+
+  int16_t GetRssi()
+  {
+    return Peripheral.rssi();
+  }
+
+  bool IsConnected()
+  {
+    return Peripheral.is_connected();
+  }
+
+  void Connect()
+  {
+    Peripheral.connect();
+  }
+
+  void Disconnect()
+  {
+    Peripheral.disconnect();
+  }
+
+  std::vector<std::pair<std::string, std::string>> GetCharacteristics()
+  {
+    std::vector<std::pair<std::string, std::string>> characteristics;
+    for (SimpleBLE::Service& s : Peripheral.services())
+    {
+      for (SimpleBLE::Characteristic& c : s.characteristics())
+      {
+        characteristics.push_back(std::make_pair(s.uuid(), c.uuid()));
+      }
+    }
+
+    return characteristics;
+  }
+
+  std::string Read(const std::string& service, const std::string& characteristic)
+  {
+    return Peripheral.read(service, characteristic);
+  }
+
+  void WriteRequest(const std::string& service,
+                    const std::string& characteristic,
+                    const std::string& value)
+  {
+    Peripheral.write_request(service, characteristic, value);
+  }
+
+  void WriteCommand(const std::string& service,
+                    const std::string& characteristic,
+                    const std::string& value)
+  {
+    Peripheral.write_command(service, characteristic, value);
+  }
+
+  void Notify(const std::string& service,
+              const std::string& characteristic,
+              PayloadCallback cb)
+  {
+    Peripheral.notify(service, characteristic, [cb](SimpleBLE::ByteArray payload)
+    {
+      cb(payload);
+    });
+  }
+
+  void Indicate(const std::string& service,
+                const std::string& characteristic,
+                PayloadCallback cb)
+  {
+    Peripheral.indicate(service, characteristic, [cb](SimpleBLE::ByteArray payload)
+    {
+      cb(payload);
+    });
+  }
+
+  void Unsubscribe(const std::string& service, const std::string& characteristic)
+  {
+    Peripheral.unsubscribe(service, characteristic);
+  }
+
+  void SetDisconnectedCallback(std::function<void()> cb)
+  {
+    Peripheral.set_callback_on_disconnected(cb);
+  }
+
+private:
+
+  SimpleBLE::Peripheral Peripheral;
+};
+
+class SimpleBLEAdapter : public BLEAdapter
+{
+public:
+
+  SimpleBLEAdapter(SimpleBLE::Adapter adapter) :
+    Adapter(adapter)
+  {
+  }
+
+  ~SimpleBLEAdapter()
+  {
+    Adapter.set_callback_on_scan_found([](SimpleBLE::Peripheral) {});
+  }
+
+  std::string GetIdentifier()
+  {
+    return Adapter.identifier();
+  }
+
+  void SetScanFoundCallback(ScanCallback cb)
+  {
+    if (nullptr == cb)
+    {
+      Adapter.set_callback_on_scan_found([](SimpleBLE::Peripheral) {});
+      return;
+    }
+
+    Adapter.set_callback_on_scan_found([cb](SimpleBLE::Peripheral peripheral)
+    {
+      cb(std::make_shared<SimpleBLEPeripheral>(peripheral));
+    });
+  }
+
+  void ScanStart()
+  {
+    Adapter.scan_start();
+  }
+
+  void ScanStop()
+  {
+    Adapter.scan_stop();
+  }
+
+private:
+
+  SimpleBLE::Adapter Adapter;
+};
+
+
+bool SimpleBLEBackend::IsBluetoothEnabled()
+{
+  return SimpleBLE::Adapter::bluetooth_enabled();
+}
+
+std::vector<std::shared_ptr<BLEAdapter>> SimpleBLEBackend::GetAdapters()
+{
+  std::vector<std::shared_ptr<BLEAdapter>> adapters;
+
+  std::vector<SimpleBLE::Adapter> found = SimpleBLE::Adapter::get_adapters();
+  for (size_t i = 0; i < found.size(); ++i)
+  {
+    adapters.push_back(std::make_shared<SimpleBLEAdapter>(found[i]));
+  }
+
+  return adapters;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "BLEBackend.h"
+
+// BLE backend for real hardware, on top of SimpleBLE
+class SimpleBLEBackend : public BLEBackend
+{
+public:
+
+  bool IsBluetoothEnabled();
+  std::vector<std::shared_ptr<BLEAdapter>> GetAdapters();
+};
@@ -0,0 +1,119 @@
+#include "StationRegistry.h"
+#include <cassert>
+
+StationRegistry::StationRegistry() :
+  FreeHead(NO_SLOT)
+{
+}
+
+StationRegistry::Handle StationRegistry::Add(LightHouse* station)
+{
+  assert(nullptr != station);
+
+  Remove(Find(station->GetAddress()));
+
+  uint32_t index = FreeHead;
+  if (NO_SLOT == index)
+  {
+    index = static_cast<uint32_t>(Slots.size());
+    Slots.push_back(Slot());
+    Slots[index].Generation = 0;
+  }
+  else
+  {
+    FreeHead = Slots[index].Link;
+  }
+
+  Slot& slot = Slots[index];
+  slot.Station.reset(station);
+  slot.Generation = (UINT32_MAX == slot.Generation) ? 1 : slot.Generation + 1;
+  slot.Link = static_cast<uint32_t>(Packed.size());
+  Packed.push_back(index);
+  Addresses[station->GetAddress()] = index;
+
+  Handle handle;
+  handle.Index = index;
+  handle.Generation = slot.Generation;
+  return handle;
+}
+
+bool StationRegistry::Remove(Handle handle)
+{
+  if (nullptr == Get(handle))
+  {
+    return false;
+  }
+
+  Slot& slot = Slots[handle.Index];
+  Addresses.erase(slot.Station->GetAddress());
+  slot.Station.reset();
+
+  // Fill the hole with the last packed station
+  uint32_t position = slot.Link;
+  Packed[position] = Packed.back();
+  Slots[Packed[position]].Link = position;
+  Packed.pop_back();
+
+  slot.Link = FreeHead;
+  FreeHead = handle.Index;
+  return true;
+}
+
+void StationRegistry::Clear()
+{
+  while (false == Packed.empty())
+  {
+    Remove(HandleAt(Packed.size() - 1));
+  }
+}
+
+LightHouse* StationRegistry::Get(Handle handle) const
+{
+  if ((handle.Index >= Slots.size()) || 
+      (0 == handle.Generation) || 
+      (handle.Generation != Slots[handle.Index].Generation))
+  {
+    return nullptr;
+  }
+
+  return Slots[handle.Index].Station.get();
+}
+
+StationRegistry::Handle StationRegistry::Find(const std::string& address) const
+{
+  Handle handle;
+  handle.Index = 0;
+  handle.Generation = 0;
+
+  std::unordered_map<std::string, uint32_t>::const_iterator itr = Addresses.find(address);
+  if (Addresses.end() != itr)
+  {
+    handle.Index = itr->second;
+    handle.Generation = Slots[itr->second].Generation;
+  }
+
+  return handle;
+}
+
+size_t StationRegistry::Size() const
+{
+  return Packed.size();
+}
+
+bool StationRegistry::Empty() const
+{
+  return Packed.empty();
+}
+
+LightHouse* StationRegistry::At(size_t position) const
+{
+  return Slots[Packed[position]].Station.get();
+}
+
+StationRegistry::Handle StationRegistry::HandleAt(size_t position) const
+{
+  Handle handle;
+  handle.Index = Packed[position];
+  handle.Generation = Slots[handle.Index].Generation;
+  return handle;
+}
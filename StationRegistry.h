@@ -0,0 +1,60 @@
+#pragma once
+#include "LightHouse.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Slot map owning the validated stations, and through them their
+// peripherals. A handle stays valid until its station is removed, after
+// which the slot is reused under a new generation and the old handle
+// resolves to nullptr. Stations are kept packed for iteration and indexed
+// by address. Not thread safe, the scan loop owns it.
+class StationRegistry
+{
+public:
+
+  // Generation 0 is never issued, so a default Handle refers to nothing
+  struct Handle
+  {
+    uint32_t Index;
+    uint32_t Generation;
+  };
+
+  StationRegistry();
+
+  // Takes ownership. A station already registered under the same address
+  // is replaced and its handle goes stale.
+  Handle Add(LightHouse* station);
+  bool Remove(Handle handle);
+  void Clear();
+
+  LightHouse* Get(Handle handle) const;
+  Handle Find(const std::string& address) const;
+
+  // Packed iteration, positions change when a station is removed
+  size_t Size() const;
+  bool Empty() const;
+  LightHouse* At(size_t position) const;
+  Handle HandleAt(size_t position) const;
+
+private:
+
+  // While occupied Link is the station's position in Packed, while free
+  // it's the next free slot
+  struct Slot
+  {
+    std::unique_ptr<LightHouse> Station;
+    uint32_t Generation;
+    uint32_t Link;
+  };
+
+  static const uint32_t NO_SLOT = UINT32_MAX;
+
+  std::vector<Slot> Slots;
+  std::vector<uint32_t> Packed;
+  uint32_t FreeHead;
+  std::unordered_map<std::string, uint32_t> Addresses;
+};
@@ -0,0 +1,281 @@
+#include "Trace.h"
+
+std::atomic<bool> Trace::Enabled(false);
+std::mutex Trace::RingsLock;
+std::vector<std::shared_ptr<Trace::Ring>> Trace::Rings;
+uint32_t Trace::NextThreadId = 0;
+
+std::mutex Trace::DrainLock;
+std::thread Trace::DrainThread;
+std::atomic<bool> Trace::DrainStopping(false);
+FILE* Trace::DrainFile = nullptr;
+uint64_t Trace::DrainEpoch = 0;
+
+namespace
+{
+  const char* EVENT_NAMES[Trace::EVENT_COUNT] =
+  {
+    "CONNECT",
+    "DISCONNECT",
+    "READ",
+    "WRITE",
+    "DISCOVER_SERVICES",
+    "SUBSCRIBE",
+    "NOTIFY",
+    "VALUE",
+    "OPERATION_FAILED",
+    "SUBSCRIBE_UNSUPPORTED",
+    "SCAN_LOOP_STALLED"
+  };
+
+  const char LEVEL_NAMES[] = { '-', 'E', 'I', 'D' };
+
+  uint64_t Now()
+  {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  // Joins the drain thread before the statics it uses go away
+  struct DrainGuard
+  {
+    ~DrainGuard()
+    {
+      Trace::StopFileDrain();
+    }
+  } drainGuard;
+}
+
+
+void Trace::Emit(LevelEnum level, EventEnum event, uint64_t subject, uint64_t arg,
+                 uint32_t durationUs, bool success)
+{
+  if (false == Enabled.load(std::memory_order_relaxed))
+  {
+    return;
+  }
+
+  Ring* ring = ThreadRing();
+  uint64_t head = ring->Head.load(std::memory_order_relaxed);
+
+  Record& record = ring->Records[head % RING_CAPACITY];
+  record.Timestamp = Now();
+  record.Subject = subject;
+  record.Arg = arg;
+  record.DurationUs = durationUs;
+  record.Event = static_cast<uint16_t>(event);
+  record.Level = static_cast<uint8_t>(level);
+  record.Success = (true == success) ? 1 : 0;
+
+  ring->Head.store(head + 1, std::memory_order_release);
+}
+
+bool Trace::IsEnabled()
+{
+  return Enabled.load(std::memory_order_relaxed);
+}
+
+bool Trace::StartFileDrain(const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(DrainLock);
+  if (nullptr != DrainFile)
+  {
+    return false;
+  }
+
+  DrainFile = fopen(path.c_str(), "w");
+  if (nullptr == DrainFile)
+  {
+    return false;
+  }
+
+  fprintf(DrainFile, "# time_us thread level event subject arg duration_us ok\n");
+  DrainEpoch = Now();
+  DrainStopping = false;
+  DrainThread = std::thread(&Trace::DrainLoop);
+  Enabled = true;
+
+  return true;
+}
+
+void Trace::StopFileDrain()
+{
+  std::lock_guard<std::mutex> lock(DrainLock);
+  if (nullptr == DrainFile)
+  {
+    return;
+  }
+
+  Enabled = false;
+  DrainStopping = true;
+  DrainThread.join();
+
+  fclose(DrainFile);
+  DrainFile = nullptr;
+}
+
+uint64_t Trace::PackAddress(const std::string& address)
+{
+  uint64_t packed = 0;
+  for (size_t i = 0; i < address.size(); ++i)
+  {
+    char c = address[i];
+    if (('0' <= c) && (c <= '9'))
+    {
+      packed = (packed << 4) | static_cast<uint64_t>(c - '0');
+    }
+    else if (('a' <= (c | 0x20)) && ((c | 0x20) <= 'f'))
+    {
+      packed = (packed << 4) | static_cast<uint64_t>((c | 0x20) - 'a' + 10);
+    }
+  }
+
+  return packed;
+}
+
+uint64_t Trace::PackValue(const Uuid128& uuid, const std::string& value)
+{
+  uint64_t packed = uuid.High >> 32;
+
+  for (size_t i = 0; i < 4; ++i)
+  {
+    packed <<= 8;
+    if (i < value.size())
+    {
+      packed |= static_cast<uint8_t>(value[i]);
+    }
+  }
+
+  return packed;
+}
+
+Trace::Span::Span(LevelEnum level, EventEnum event, uint64_t subject, uint64_t arg) :
+  Subject(subject),
+  Arg(arg),
+  Event(static_cast<uint16_t>(event)),
+  Level(static_cast<uint8_t>(level)),
+  Success(false),
+  Active(Trace::IsEnabled())
+{
+  if (true == Active)
+  {
+    Start = std::chrono::steady_clock::now();
+  }
+}
+
+Trace::Span::~Span()
+{
+  if (true == Active)
+  {
+    uint32_t duration = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - Start).count());
+    Emit(static_cast<LevelEnum>(Level), static_cast<EventEnum>(Event), Subject, Arg, duration, Success);
+  }
+}
+
+void Trace::Span::Succeeded()
+{
+  Success = true;
+}
+
+Trace::RingOwner::~RingOwner()
+{
+  if (nullptr != Owned)
+  {
+    Owned->Retired = true;
+  }
+}
+
+Trace::Ring* Trace::ThreadRing()
+{
+  // Allocated once per thread, the drain keeps it alive after the thread
+  // exits until everything in it has been written out.
+  static thread_local RingOwner owner;
+  if (nullptr == owner.Owned)
+  {
+    std::shared_ptr<Ring> ring = std::make_shared<Ring>();
+    ring->Head = 0;
+    ring->Tail = 0;
+    ring->Retired = false;
+
+    std::lock_guard<std::mutex> lock(RingsLock);
+    ring->ThreadId = NextThreadId++;
+    Rings.push_back(ring);
+    owner.Owned = ring;
+  }
+
+  return owner.Owned.get();
+}
+
+void Trace::DrainLoop()
+{
+  while (false == DrainStopping)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_INTERVAL_MS));
+    DrainRings(DrainFile);
+  }
+
+  DrainRings(DrainFile);
+  fflush(DrainFile);
+}
+
+void Trace::DrainRings(FILE* file)
+{
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock(RingsLock);
+    rings = Rings;
+  }
+
+  for (size_t r = 0; r < rings.size(); ++r)
+  {
+    Ring& ring = *rings[r];
+    uint64_t head = ring.Head.load(std::memory_order_acquire);
+
+    // The writer never waits for us, anything it lapped is lost
+    if (RING_CAPACITY < head - ring.Tail)
+    {
+      fprintf(file, "# thread %u dropped %llu records\n", ring.ThreadId,
+              static_cast<unsigned long long>(head - RING_CAPACITY - ring.Tail));
+      ring.Tail = head - RING_CAPACITY;
+    }
+
+    for (; ring.Tail < head; ++ring.Tail)
+    {
+      Record record = ring.Records[ring.Tail % RING_CAPACITY];
+
+      // Overwritten while we were copying it
+      if (RING_CAPACITY <= ring.Head.load(std::memory_order_acquire) - ring.Tail)
+      {
+        continue;
+      }
+
+      fprintf(file, "%llu %u %c %s %012llx %016llx %u %u\n",
+              static_cast<unsigned long long>((record.Timestamp - DrainEpoch) / 1000),
+              ring.ThreadId,
+              LEVEL_NAMES[record.Level & 3],
+              (record.Event < EVENT_COUNT) ? EVENT_NAMES[record.Event] : "?",
+              static_cast<unsigned long long>(record.Subject),
+              static_cast<unsigned long long>(record.Arg),
+              record.DurationUs,
+              record.Success);
+    }
+  }
+
+  // Rings of finished threads go once they're empty
+  std::lock_guard<std::mutex> lock(RingsLock);
+  for (size_t r = 0; r < Rings.size();)
+  {
+    if ((true == Rings[r]->Retired) &&
+        (Rings[r]->Tail == Rings[r]->Head.load(std::memory_order_acquire)))
+    {
+      Rings.erase(Rings.begin() + r);
+    }
+    else
+    {
+      ++r;
+    }
+  }
+
+  fflush(file);
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include "Uuid128.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records above TRACE_LEVEL compile away, and while tracing is off at run
+// time the macros' arguments aren't evaluated. Build with
+// TRACE_LEVEL=TRACE_LEVEL_OFF to remove tracing altogether.
+#define TRACE_LEVEL_OFF   0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO  2
+#define TRACE_LEVEL_DEBUG 3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+// Fixed-size binary trace records kept in a ring per thread. Emitting is a
+// relaxed load while tracing is off and a copy into the calling thread's
+// ring while it's on, neither allocates. StartFileDrain() turns tracing on
+// and formats the records to a file from its own thread.
+class Trace
+{
+public:
+
+  enum LevelEnum
+  {
+    LEVEL_ERROR = TRACE_LEVEL_ERROR,
+    LEVEL_INFO  = TRACE_LEVEL_INFO,
+    LEVEL_DEBUG = TRACE_LEVEL_DEBUG
+  };
+
+  enum EventEnum
+  {
+    CONNECT,
+    DISCONNECT,
+    READ,
+    WRITE,
+    DISCOVER_SERVICES,
+    SUBSCRIBE,
+    NOTIFY,
+    VALUE,
+    OPERATION_FAILED,
+    SUBSCRIBE_UNSUPPORTED,
+    SCAN_LOOP_STALLED,
+    EVENT_COUNT
+  };
+
+  // Subject is usually a packed BLE address, Arg a short characteristic
+  // UUID and/or value bytes. Timestamp is taken when the record is emitted,
+  // so a span started DurationUs earlier. Duration is 0 for point events.
+  struct Record
+  {
+    uint64_t Timestamp;
+    uint64_t Subject;
+    uint64_t Arg;
+    uint32_t DurationUs;
+    uint16_t Event;
+    uint8_t  Level;
+    uint8_t  Success;
+  };
+
+  static const size_t   RING_CAPACITY = 2048;
+  static const uint32_t DRAIN_INTERVAL_MS = 100;
+
+  static void Emit(LevelEnum level, EventEnum event, uint64_t subject, uint64_t arg,
+                   uint32_t durationUs = 0, bool success = true);
+  static bool IsEnabled();
+
+  static bool StartFileDrain(const std::string& path);
+  static void StopFileDrain();
+
+  // "aa:bb:cc:dd:ee:ff" as a 48 bit number
+  static uint64_t PackAddress(const std::string& address);
+  // First 32 bits of the UUID in the high half, up to 4 value bytes below
+  static uint64_t PackValue(const Uuid128& uuid, const std::string& value);
+
+  // Times a BLE operation, recorded as failed unless Succeeded() is called
+  // (e.g. when the operation throws).
+  class Span
+  {
+  public:
+
+    Span(LevelEnum level, EventEnum event, uint64_t subject, uint64_t arg);
+    ~Span();
+    void Succeeded();
+
+  private:
+
+    std::chrono::steady_clock::time_point Start;
+    uint64_t Subject;
+    uint64_t Arg;
+    uint16_t Event;
+    uint8_t Level;
+    bool Success;
+    bool Active;
+  };
+
+private:
+
+  struct Ring
+  {
+    Record Records[RING_CAPACITY];
+    std::atomic<uint64_t> Head;
+    uint64_t Tail;
+    uint32_t ThreadId;
+    std::atomic<bool> Retired;
+  };
+
+  struct RingOwner
+  {
+    std::shared_ptr<Ring> Owned;
+    ~RingOwner();
+  };
+
+  static Ring* ThreadRing();
+  static void DrainLoop();
+  static void DrainRings(FILE* file);
+
+  static std::atomic<bool> Enabled;
+  static std::mutex RingsLock;
+  static std::vector<std::shared_ptr<Ring>> Rings;
+  static uint32_t NextThreadId;
+
+  static std::mutex DrainLock;
+  static std::thread DrainThread;
+  static std::atomic<bool> DrainStopping;
+  static FILE* DrainFile;
+  static uint64_t DrainEpoch;
+};
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(event, subject, arg) \
+  do { if (Trace::IsEnabled()) Trace::Emit(Trace::LEVEL_ERROR, Trace::event, subject, arg, 0, false); } while (0)
+#else
+#define TRACE_ERROR(event, subject, arg) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(event, subject, arg) \
+  do { if (Trace::IsEnabled()) Trace::Emit(Trace::LEVEL_INFO, Trace::event, subject, arg); } while (0)
+#define TRACE_SPAN(name, event, subject, arg) Trace::Span name(Trace::LEVEL_INFO, Trace::event, subject, arg)
+#define TRACE_SPAN_OK(name) name.Succeeded()
+#else
+#define TRACE_INFO(event, subject, arg) ((void)0)
+#define TRACE_SPAN(name, event, subject, arg) ((void)0)
+#define TRACE_SPAN_OK(name) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(event, subject, arg) \
+  do { if (Trace::IsEnabled()) Trace::Emit(Trace::LEVEL_DEBUG, Trace::event, subject, arg); } while (0)
+#else
+#define TRACE_DEBUG(event, subject, arg) ((void)0)
+#endif
@@ -0,0 +1,27 @@
+#include "Uuid128.h"
+
+bool Uuid128::Parse(const std::string& text, Uuid128& uuid)
+{
+  return TryParse(text.c_str(), text.size(), uuid);
+}
+
+std::string Uuid128::ToString() const
+{
+  static const char DIGITS[] = "0123456789abcdef";
+
+  std::string text(TEXT_LENGTH, '-');
+  size_t digits = 0;
+  for (size_t i = 0; i < TEXT_LENGTH; ++i)
+  {
+    if ((8 == i) || (13 == i) || (18 == i) || (23 == i))
+    {
+      continue;
+    }
+
+    uint64_t half = (16 > digits) ? High : Low;
+    text[i] = DIGITS[(half >> (60 - 4 * (digits % 16))) & 0xf];
+    ++digits;
+  }
+
+  return text;
+}
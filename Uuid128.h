@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// 128-bit BLE UUID. Literals are parsed at compile time and strings from the
+// BLE stack once, when a station's services are discovered, so comparing two
+// UUIDs is two integer compares.
+struct Uuid128
+{
+  uint64_t High;
+  uint64_t Low;
+
+  // "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx", either case. A malformed
+  // literal fails to compile.
+  template <size_t N>
+  static constexpr Uuid128 FromString(const char (&text)[N])
+  {
+    Uuid128 uuid = { 0, 0 };
+    if (false == TryParse(text, N - 1, uuid))
+    {
+      throw std::invalid_argument("malformed UUID");
+    }
+
+    return uuid;
+  }
+
+  static bool Parse(const std::string& text, Uuid128& uuid);
+
+  // Lower case, the way the BLE stack reports them
+  std::string ToString() const;
+
+  constexpr bool operator==(const Uuid128& other) const
+  {
+    return (High == other.High) && (Low == other.Low);
+  }
+
+  constexpr bool operator!=(const Uuid128& other) const
+  {
+    return false == (*this == other);
+  }
+
+  constexpr bool operator<(const Uuid128& other) const
+  {
+    return (High < other.High) || ((High == other.High) && (Low < other.Low));
+  }
+
+  static const size_t TEXT_LENGTH = 36;
+
+private:
+
+  static constexpr int HexDigit(char c)
+  {
+    return (('0' <= c) && ('9' >= c)) ? c - '0' :
+           (('a' <= c) && ('f' >= c)) ? c - 'a' + 10 :
+           (('A' <= c) && ('F' >= c)) ? c - 'A' + 10 : -1;
+  }
+
+  static constexpr bool TryParse(const char* text, size_t length, Uuid128& uuid)
+  {
+    if (TEXT_LENGTH != length)
+    {
+      return false;
+    }
+
+    uuid.High = 0;
+    uuid.Low = 0;
+    size_t digits = 0;
+    for (size_t i = 0; i < TEXT_LENGTH; ++i)
+    {
+      if ((8 == i) || (13 == i) || (18 == i) || (23 == i))
+      {
+        if ('-' != text[i])
+        {
+          return false;
+        }
+
+        continue;
+      }
+
+      int digit = HexDigit(text[i]);
+      if (0 > digit)
+      {
+        return false;
+      }
+
+      uint64_t& half = (16 > digits) ? uuid.High : uuid.Low;
+      half = (half << 4) | static_cast<uint64_t>(digit);
+      ++digits;
+    }
+
+    return true;
+  }
+};
@@ -0,0 +1,433 @@
+#include "VRSessionDetector.h"
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <TlHelp32.h>
+#else
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* VRSessionDetector::VR_PROCESS_NAME = "vrmonitor.exe";
+
+// The launcher and the server both come up seconds before vrmonitor
+const std::vector<std::string> VRSessionDetector::STARTUP_PROCESS_NAMES =
+{
+  "vrstartup.exe",
+  "vrserver.exe"
+};
+
+#ifdef _WIN32
+
+// Exits are waited on through the process handle. Windows has no
+// unprivileged process start notification, so starts are probed from the
+// detector thread instead of the control loop.
+class WinSessionDetector : public VRSessionDetector
+{
+public:
+
+  WinSessionDetector(const std::vector<std::string>& processNames,
+                     SessionCallback cb,
+                     void* pContext) :
+    VRSessionDetector(processNames, cb, pContext),
+    StopEvent(CreateEventA(nullptr, TRUE, FALSE, nullptr))
+  {
+    for (size_t i = 0; i < processNames.size(); ++i)
+    {
+      WideNames.push_back(std::wstring(processNames[i].begin(), processNames[i].end()));
+    }
+
+    Worker = std::thread(&WinSessionDetector::Run, this);
+  }
+
+  ~WinSessionDetector()
+  {
+    Stop();
+    CloseHandle(StopEvent);
+  }
+
+  void Stop()
+  {
+    if (true == Worker.joinable())
+    {
+      SetEvent(StopEvent);
+      Worker.join();
+    }
+  }
+
+private:
+
+  void Run()
+  {
+    for (;;)
+    {
+      HANDLE process = FindProcess();
+      if (nullptr != process)
+      {
+        SetActive(true);
+
+        HANDLE handles[] = { StopEvent, process };
+        DWORD res = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        CloseHandle(process);
+
+        if (WAIT_OBJECT_0 == res)
+        {
+          break;
+        }
+
+        // Look again straight away, another instance may still be running
+        continue;
+      }
+
+      SetActive(false);
+
+      if (WAIT_OBJECT_0 == WaitForSingleObject(StopEvent, START_PROBE_MS))
+      {
+        break;
+      }
+    }
+  }
+
+  HANDLE FindProcess() const
+  {
+    HANDLE process = nullptr;
+
+    HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (INVALID_HANDLE_VALUE != hSnap)
+    {
+      PROCESSENTRY32W pe32;
+      pe32.dwSize = sizeof(PROCESSENTRY32W);
+      if (Process32FirstW(hSnap, &pe32))
+      {
+        do
+        {
+          if (true == IsWatchedName(pe32.szExeFile))
+          {
+            process = OpenProcess(SYNCHRONIZE, FALSE, pe32.th32ProcessID);
+            if (nullptr != process)
+            {
+              break;
+            }
+          }
+        } while (Process32NextW(hSnap, &pe32));
+      }
+
+      CloseHandle(hSnap);
+    }
+
+    return process;
+  }
+
+  bool IsWatchedName(const wchar_t* exeFile) const
+  {
+    for (size_t i = 0; i < WideNames.size(); ++i)
+    {
+      if (0 == _wcsicmp(exeFile, WideNames[i].c_str()))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  std::vector<std::wstring> WideNames;
+  HANDLE StopEvent;
+  std::thread Worker;
+};
+
+#else
+
+// Starts come from the proc connector when we're allowed to subscribe to it
+// (CAP_NET_ADMIN), otherwise /proc is probed from the detector thread.
+// Exits are waited on through a pidfd.
+class LinuxSessionDetector : public VRSessionDetector
+{
+public:
+
+  LinuxSessionDetector(const std::vector<std::string>& processNames,
+                       SessionCallback cb,
+                       void* pContext) :
+    VRSessionDetector(processNames, cb, pContext),
+    StopFd(eventfd(0, EFD_CLOEXEC))
+  {
+    // /proc/<pid>/comm has no extension and is truncated to 15 characters
+    for (size_t i = 0; i < processNames.size(); ++i)
+    {
+      CommNames.push_back(processNames[i].substr(0, processNames[i].rfind(".exe")).substr(0, 15));
+    }
+
+    Worker = std::thread(&LinuxSessionDetector::Run, this);
+  }
+
+  ~LinuxSessionDetector()
+  {
+    Stop();
+    close(StopFd);
+  }
+
+  void Stop()
+  {
+    if (true == Worker.joinable())
+    {
+      uint64_t one = 1;
+      (void)write(StopFd, &one, sizeof(one));
+      Worker.join();
+    }
+  }
+
+private:
+
+  void Run()
+  {
+    int connector = OpenProcConnector();
+
+    for (;;)
+    {
+      pid_t pid = FindProcess();
+      if (0 < pid)
+      {
+        SetActive(true);
+
+        if (true == WaitForExit(pid))
+        {
+          break;
+        }
+
+        continue;
+      }
+
+      SetActive(false);
+
+      if (true == WaitForStart(connector))
+      {
+        break;
+      }
+    }
+
+    if (0 <= connector)
+    {
+      close(connector);
+    }
+  }
+
+  // Returns true if the detector was asked to stop
+  bool WaitForExit(pid_t pid) const
+  {
+    int pidFd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+
+    pollfd fds[2] = { { StopFd, POLLIN, 0 }, { pidFd, POLLIN, 0 } };
+    for (;;)
+    {
+      // Without pidfd support fall back to checking on the probe interval
+      int res = (0 <= pidFd) ? poll(fds, 2, -1) : poll(fds, 1, START_PROBE_MS);
+      if (0 != (fds[0].revents & POLLIN))
+      {
+        break;
+      }
+
+      if ((0 <= pidFd) ? (0 < res) : (0 != kill(pid, 0)))
+      {
+        break;
+      }
+    }
+
+    if (0 <= pidFd)
+    {
+      close(pidFd);
+    }
+
+    return (0 != (fds[0].revents & POLLIN));
+  }
+
+  // Returns true if the detector was asked to stop
+  bool WaitForStart(int connector) const
+  {
+    pollfd fds[2] = { { StopFd, POLLIN, 0 }, { connector, POLLIN, 0 } };
+    for (;;)
+    {
+      int res = (0 <= connector) ? poll(fds, 2, -1) : poll(fds, 1, START_PROBE_MS);
+      if (0 != (fds[0].revents & POLLIN))
+      {
+        return true;
+      }
+
+      if ((0 > connector) || (0 > res))
+      {
+        return false;
+      }
+
+      // Only wake the scan for execs of the process we're watching
+      if ((0 != (fds[1].revents & POLLIN)) && (true == ReadExecEvents(connector)))
+      {
+        return false;
+      }
+    }
+  }
+
+  int OpenProcConnector() const
+  {
+    int sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (0 > sock)
+    {
+      return -1;
+    }
+
+    sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0;
+
+    // nlmsghdr | cn_msg | proc_cn_mcast_op
+    alignas(nlmsghdr) char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))];
+    memset(request, 0, sizeof(request));
+
+    nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+    header->nlmsg_type = NLMSG_DONE;
+
+    cn_msg* message = reinterpret_cast<cn_msg*>(NLMSG_DATA(header));
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof(proc_cn_mcast_op);
+
+    proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+    memcpy(message->data, &op, sizeof(op));
+
+    if ((0 != bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) ||
+        (0 > send(sock, header, header->nlmsg_len, 0)))
+    {
+      close(sock);
+      return -1;
+    }
+
+    return sock;
+  }
+
+  bool ReadExecEvents(int connector) const
+  {
+    alignas(nlmsghdr) char response[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_event))];
+
+    bool matched = false;
+    while (0 < recv(connector, response, sizeof(response), MSG_DONTWAIT))
+    {
+      const nlmsghdr* header = reinterpret_cast<const nlmsghdr*>(response);
+      const cn_msg* message = reinterpret_cast<const cn_msg*>(NLMSG_DATA(header));
+      const proc_event* event = reinterpret_cast<const proc_event*>(message->data);
+
+      if ((proc_event::PROC_EVENT_EXEC == event->what) &&
+          (true == IsWatchedProcess(event->event_data.exec.process_pid)))
+      {
+        matched = true;
+      }
+    }
+
+    return matched;
+  }
+
+  pid_t FindProcess() const
+  {
+    pid_t found = 0;
+
+    DIR* proc = opendir("/proc");
+    if (nullptr != proc)
+    {
+      for (dirent* entry = readdir(proc); nullptr != entry; entry = readdir(proc))
+      {
+        pid_t pid = static_cast<pid_t>(atoi(entry->d_name));
+        if ((0 < pid) && (true == IsWatchedProcess(pid)))
+        {
+          found = pid;
+          break;
+        }
+      }
+
+      closedir(proc);
+    }
+
+    return found;
+  }
+
+  bool IsWatchedProcess(pid_t pid) const
+  {
+    std::string comm;
+    std::ifstream file("/proc/" + std::to_string(pid) + "/comm");
+    std::getline(file, comm);
+
+    return (CommNames.end() != std::find(CommNames.begin(), CommNames.end(), comm));
+  }
+
+  std::vector<std::string> CommNames;
+  int StopFd;
+  std::thread Worker;
+};
+
+#endif
+
+VRSessionDetector* VRSessionDetector::Create(std::string processName,
+                                             SessionCallback cb,
+                                             void* pContext)
+{
+  return Create(std::vector<std::string>(1, processName), cb, pContext);
+}
+
+// The callback is in place before the worker starts, so a process that's
+// already running is reported too
+VRSessionDetector* VRSessionDetector::Create(const std::vector<std::string>& processNames,
+                                             SessionCallback cb,
+                                             void* pContext)
+{
+#ifdef _WIN32
+  return new WinSessionDetector(processNames, cb, pContext);
+#else
+  return new LinuxSessionDetector(processNames, cb, pContext);
+#endif
+}
+
+void VRSessionDetector::Destroy(VRSessionDetector* instance)
+{
+  delete instance;
+}
+
+bool VRSessionDetector::IsActive() const
+{
+  return Active;
+}
+
+VRSessionDetector::VRSessionDetector(const std::vector<std::string>& processNames,
+                                     SessionCallback cb,
+                                     void* pContext) :
+  ProcessNames(processNames),
+  Active(false),
+  _SessionCallback(cb),
+  SessionContext(pContext)
+{
+}
+
+VRSessionDetector::~VRSessionDetector()
+{
+}
+
+void VRSessionDetector::SetActive(bool active)
+{
+  if (active != Active.exchange(active))
+  {
+    if (nullptr != _SessionCallback)
+    {
+      _SessionCallback(active, SessionContext);
+    }
+  }
+}
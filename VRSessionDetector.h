@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Tracks whether a VR session process is running. Backends watch for the
+// process starting/exiting on their own thread and cache the result, so
+// IsActive() is a plain atomic load. Given several names, it's active while
+// any of them is running.
+class VRSessionDetector
+{
+public:
+
+  // Invoked from the detector's thread whenever the session state changes,
+  // including the first check if the process is already running
+  typedef void(*SessionCallback)(bool active, void* pContext);
+
+  static const char*    VR_PROCESS_NAME;
+  static const std::vector<std::string> STARTUP_PROCESS_NAMES;
+  static const uint32_t START_PROBE_MS = 1000;
+
+  static VRSessionDetector* Create(std::string processName,
+                                   SessionCallback cb = nullptr,
+                                   void* pContext = nullptr);
+  static VRSessionDetector* Create(const std::vector<std::string>& processNames,
+                                   SessionCallback cb = nullptr,
+                                   void* pContext = nullptr);
+  static void Destroy(VRSessionDetector* instance);
+
+  bool IsActive() const;
+
+  // Joins the detector's thread, the callback isn't invoked again and
+  // IsActive() keeps its last value
+  virtual void Stop() = 0;
+
+  virtual ~VRSessionDetector();
+
+protected:
+
+  VRSessionDetector(const std::vector<std::string>& processNames,
+                    SessionCallback cb,
+                    void* pContext);
+  void SetActive(bool active);
+
+  std::vector<std::string> ProcessNames;
+
+private:
+
+  std::atomic<bool> Active;
+  const SessionCallback _SessionCallback;
+  void* const SessionContext;
+};